@@ -0,0 +1,652 @@
+/*
+ * A minimal in-memory Secret Service for benchmarking envchain.
+ *
+ * Implements just enough of org.freedesktop.Secret.{Service,Collection,Item,
+ * Session} for libsecret to talk to it: "plain" sessions only, a single
+ * always-unlocked collection aliased as "default", and no prompts.
+ *
+ * Usage: mock-secret-service [--namespaces N] [--keys N] [--value-size BYTES]
+ *                            [--unrelated N]
+ *
+ * Seeds N namespaces with N keys each under the envchain schema plus a number
+ * of unrelated items, claims org.freedesktop.secrets on the session bus and
+ * prints "ready" once it can be used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#define SERVICE_PATH "/org/freedesktop/secrets"
+#define COLLECTION_PATH "/org/freedesktop/secrets/collection/login"
+#define ENVCHAIN_SCHEMA "envchain.EnvironmentVariable"
+
+static const gchar introspection_xml[] =
+  "<node>"
+  "  <interface name='org.freedesktop.Secret.Service'>"
+  "    <method name='OpenSession'>"
+  "      <arg name='algorithm' type='s' direction='in'/>"
+  "      <arg name='input' type='v' direction='in'/>"
+  "      <arg name='output' type='v' direction='out'/>"
+  "      <arg name='result' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='SearchItems'>"
+  "      <arg name='attributes' type='a{ss}' direction='in'/>"
+  "      <arg name='unlocked' type='ao' direction='out'/>"
+  "      <arg name='locked' type='ao' direction='out'/>"
+  "    </method>"
+  "    <method name='Unlock'>"
+  "      <arg name='objects' type='ao' direction='in'/>"
+  "      <arg name='unlocked' type='ao' direction='out'/>"
+  "      <arg name='prompt' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='Lock'>"
+  "      <arg name='objects' type='ao' direction='in'/>"
+  "      <arg name='locked' type='ao' direction='out'/>"
+  "      <arg name='prompt' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='GetSecrets'>"
+  "      <arg name='items' type='ao' direction='in'/>"
+  "      <arg name='session' type='o' direction='in'/>"
+  "      <arg name='secrets' type='a{o(oayays)}' direction='out'/>"
+  "    </method>"
+  "    <method name='ReadAlias'>"
+  "      <arg name='name' type='s' direction='in'/>"
+  "      <arg name='collection' type='o' direction='out'/>"
+  "    </method>"
+  "    <property name='Collections' type='ao' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.freedesktop.Secret.Collection'>"
+  "    <method name='SearchItems'>"
+  "      <arg name='attributes' type='a{ss}' direction='in'/>"
+  "      <arg name='results' type='ao' direction='out'/>"
+  "    </method>"
+  "    <method name='CreateItem'>"
+  "      <arg name='properties' type='a{sv}' direction='in'/>"
+  "      <arg name='secret' type='(oayays)' direction='in'/>"
+  "      <arg name='replace' type='b' direction='in'/>"
+  "      <arg name='item' type='o' direction='out'/>"
+  "      <arg name='prompt' type='o' direction='out'/>"
+  "    </method>"
+  "    <signal name='ItemCreated'><arg name='item' type='o'/></signal>"
+  "    <signal name='ItemDeleted'><arg name='item' type='o'/></signal>"
+  "    <signal name='ItemChanged'><arg name='item' type='o'/></signal>"
+  "    <property name='Items' type='ao' access='read'/>"
+  "    <property name='Label' type='s' access='read'/>"
+  "    <property name='Locked' type='b' access='read'/>"
+  "    <property name='Created' type='t' access='read'/>"
+  "    <property name='Modified' type='t' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.freedesktop.Secret.Item'>"
+  "    <method name='Delete'>"
+  "      <arg name='prompt' type='o' direction='out'/>"
+  "    </method>"
+  "    <method name='GetSecret'>"
+  "      <arg name='session' type='o' direction='in'/>"
+  "      <arg name='secret' type='(oayays)' direction='out'/>"
+  "    </method>"
+  "    <method name='SetSecret'>"
+  "      <arg name='secret' type='(oayays)' direction='in'/>"
+  "    </method>"
+  "    <property name='Locked' type='b' access='read'/>"
+  "    <property name='Attributes' type='a{ss}' access='readwrite'/>"
+  "    <property name='Label' type='s' access='readwrite'/>"
+  "    <property name='Created' type='t' access='read'/>"
+  "    <property name='Modified' type='t' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.freedesktop.Secret.Session'>"
+  "    <method name='Close'/>"
+  "  </interface>"
+  "</node>";
+
+typedef struct {
+  gchar *path;
+  gchar *label;
+  GHashTable *attributes;
+  GBytes *secret;
+  gchar *content_type;
+  guint64 created;
+  guint registration_id;
+} MockItem;
+
+static GDBusNodeInfo *introspection;
+static GDBusConnection *connection;
+static GHashTable *items; /* path -> MockItem */
+static guint next_item_id = 0;
+static guint next_session_id = 0;
+
+/* helpers */
+
+static gboolean
+item_matches(MockItem *item, GVariant *query)
+{
+  GVariantIter iter;
+  const gchar *key, *value;
+
+  g_variant_iter_init(&iter, query);
+  while (g_variant_iter_next(&iter, "{&s&s}", &key, &value)) {
+    const gchar *actual = g_hash_table_lookup(item->attributes, key);
+    if (actual == NULL || strcmp(actual, value) != 0) return FALSE;
+  }
+  return TRUE;
+}
+
+static GVariant*
+search(GVariant *query)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer path, item;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("ao"));
+  g_hash_table_iter_init(&iter, items);
+  while (g_hash_table_iter_next(&iter, &path, &item)) {
+    if (item_matches(item, query)) g_variant_builder_add(&builder, "o", path);
+  }
+  return g_variant_builder_end(&builder);
+}
+
+static GVariant*
+empty_bytes(void)
+{
+  return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, "", 0, 1);
+}
+
+static GVariant*
+secret_variant(MockItem *item, const gchar *session)
+{
+  gsize len;
+  gconstpointer data = g_bytes_get_data(item->secret, &len);
+
+  return g_variant_new("(o@ay@ays)", session, empty_bytes(),
+                       g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, len, 1),
+                       item->content_type);
+}
+
+static GVariant*
+attributes_variant(GHashTable *attributes)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+  g_hash_table_iter_init(&iter, attributes);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    g_variant_builder_add(&builder, "{ss}", key, value);
+  }
+  return g_variant_builder_end(&builder);
+}
+
+static GHashTable*
+attributes_from_variant(GVariant *variant)
+{
+  GHashTable *attributes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  GVariantIter iter;
+  const gchar *key, *value;
+
+  g_variant_iter_init(&iter, variant);
+  while (g_variant_iter_next(&iter, "{&s&s}", &key, &value)) {
+    g_hash_table_insert(attributes, g_strdup(key), g_strdup(value));
+  }
+  return attributes;
+}
+
+static void
+emit_collection_signal(const gchar *signal, const gchar *path)
+{
+  if (connection == NULL) return;
+  g_dbus_connection_emit_signal(connection, NULL, COLLECTION_PATH,
+                                "org.freedesktop.Secret.Collection", signal,
+                                g_variant_new("(o)", path), NULL);
+}
+
+/* objects */
+
+static void item_method_call(GDBusConnection *, const gchar *, const gchar *,
+                             const gchar *, const gchar *, GVariant *,
+                             GDBusMethodInvocation *, gpointer);
+static GVariant *item_get_property(GDBusConnection *, const gchar *, const gchar *,
+                                   const gchar *, const gchar *, GError **, gpointer);
+static gboolean item_set_property(GDBusConnection *, const gchar *, const gchar *,
+                                  const gchar *, const gchar *, GVariant *,
+                                  GError **, gpointer);
+
+static const GDBusInterfaceVTable item_vtable = {
+  item_method_call, item_get_property, item_set_property, {0}
+};
+
+static void
+item_free(gpointer data)
+{
+  MockItem *item = data;
+  if (item->registration_id && connection) {
+    g_dbus_connection_unregister_object(connection, item->registration_id);
+  }
+  g_free(item->path);
+  g_free(item->label);
+  g_hash_table_unref(item->attributes);
+  g_bytes_unref(item->secret);
+  g_free(item->content_type);
+  g_free(item);
+}
+
+static void
+item_register(MockItem *item)
+{
+  GError *error = NULL;
+
+  item->registration_id = g_dbus_connection_register_object(
+    connection, item->path,
+    g_dbus_node_info_lookup_interface(introspection, "org.freedesktop.Secret.Item"),
+    &item_vtable, item, NULL, &error);
+  if (error != NULL) {
+    g_printerr("register %s: %s\n", item->path, error->message);
+    g_error_free(error);
+  }
+}
+
+static MockItem*
+item_add(const gchar *label, GHashTable *attributes, gconstpointer secret, gsize secret_len,
+         const gchar *content_type)
+{
+  MockItem *item = g_new0(MockItem, 1);
+
+  item->path = g_strdup_printf("%s/%u", COLLECTION_PATH, ++next_item_id);
+  item->label = g_strdup(label);
+  item->attributes = attributes;
+  item->secret = g_bytes_new(secret, secret_len);
+  item->content_type = g_strdup(content_type);
+  item->created = g_get_real_time() / G_USEC_PER_SEC;
+
+  g_hash_table_insert(items, item->path, item);
+  if (connection) item_register(item);
+  return item;
+}
+
+static void
+item_method_call(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                 const gchar *interface_name, const gchar *method_name,
+                 GVariant *parameters, GDBusMethodInvocation *invocation,
+                 gpointer user_data)
+{
+  MockItem *item = user_data;
+  (void)conn; (void)sender; (void)object_path; (void)interface_name;
+
+  if (strcmp(method_name, "GetSecret") == 0) {
+    const gchar *session;
+    g_variant_get(parameters, "(&o)", &session);
+    g_dbus_method_invocation_return_value(
+      invocation, g_variant_new("(@(oayays))", secret_variant(item, session)));
+  }
+  else if (strcmp(method_name, "SetSecret") == 0) {
+    GVariant *value;
+    const gchar *content_type;
+    gsize len;
+    g_variant_get(parameters, "((&o@ay@ay&s))", NULL, NULL, &value, &content_type);
+    gconstpointer data = g_variant_get_fixed_array(value, &len, 1);
+    g_bytes_unref(item->secret);
+    item->secret = g_bytes_new(data, len);
+    g_free(item->content_type);
+    item->content_type = g_strdup(content_type);
+    g_variant_unref(value);
+    emit_collection_signal("ItemChanged", item->path);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+  }
+  else if (strcmp(method_name, "Delete") == 0) {
+    gchar *path = g_strdup(item->path);
+    g_hash_table_remove(items, path); /* frees item */
+    emit_collection_signal("ItemDeleted", path);
+    g_free(path);
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(o)", "/"));
+  }
+}
+
+static GVariant*
+item_get_property(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                  const gchar *interface_name, const gchar *property_name,
+                  GError **error, gpointer user_data)
+{
+  MockItem *item = user_data;
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)error;
+
+  if (strcmp(property_name, "Locked") == 0) return g_variant_new_boolean(FALSE);
+  if (strcmp(property_name, "Attributes") == 0) return attributes_variant(item->attributes);
+  if (strcmp(property_name, "Label") == 0) return g_variant_new_string(item->label);
+  return g_variant_new_uint64(item->created);
+}
+
+static gboolean
+item_set_property(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                  const gchar *interface_name, const gchar *property_name,
+                  GVariant *value, GError **error, gpointer user_data)
+{
+  MockItem *item = user_data;
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)error;
+
+  if (strcmp(property_name, "Attributes") == 0) {
+    g_hash_table_unref(item->attributes);
+    item->attributes = attributes_from_variant(value);
+  }
+  else if (strcmp(property_name, "Label") == 0) {
+    g_free(item->label);
+    item->label = g_variant_dup_string(value, NULL);
+  }
+  emit_collection_signal("ItemChanged", item->path);
+  return TRUE;
+}
+
+static void
+collection_method_call(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                       const gchar *interface_name, const gchar *method_name,
+                       GVariant *parameters, GDBusMethodInvocation *invocation,
+                       gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)user_data;
+
+  if (strcmp(method_name, "SearchItems") == 0) {
+    GVariant *query = g_variant_get_child_value(parameters, 0);
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(@ao)", search(query)));
+    g_variant_unref(query);
+  }
+  else if (strcmp(method_name, "CreateItem") == 0) {
+    GVariant *properties, *value, *attrs_variant = NULL;
+    const gchar *content_type, *label = "";
+    gboolean replace;
+    gsize len;
+    MockItem *item = NULL;
+
+    g_variant_get(parameters, "(@a{sv}(&o@ay@ay&s)b)", &properties, NULL, NULL, &value,
+                  &content_type, &replace);
+    g_variant_lookup(properties, "org.freedesktop.Secret.Item.Label", "&s", &label);
+    attrs_variant = g_variant_lookup_value(properties, "org.freedesktop.Secret.Item.Attributes",
+                                           G_VARIANT_TYPE("a{ss}"));
+    GHashTable *attributes = attrs_variant
+      ? attributes_from_variant(attrs_variant)
+      : g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gconstpointer data = g_variant_get_fixed_array(value, &len, 1);
+
+    if (replace && attrs_variant) {
+      GHashTableIter iter;
+      gpointer path, candidate;
+      g_hash_table_iter_init(&iter, items);
+      while (g_hash_table_iter_next(&iter, &path, &candidate)) {
+        if (item_matches(candidate, attrs_variant)
+            && g_hash_table_size(((MockItem*)candidate)->attributes) == g_hash_table_size(attributes)) {
+          item = candidate;
+          break;
+        }
+      }
+    }
+
+    if (item) {
+      g_bytes_unref(item->secret);
+      item->secret = g_bytes_new(data, len);
+      g_free(item->label);
+      item->label = g_strdup(label);
+      g_hash_table_unref(attributes);
+      emit_collection_signal("ItemChanged", item->path);
+    }
+    else {
+      item = item_add(label, attributes, data, len, content_type);
+      emit_collection_signal("ItemCreated", item->path);
+    }
+
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(oo)", item->path, "/"));
+    if (attrs_variant) g_variant_unref(attrs_variant);
+    g_variant_unref(properties);
+    g_variant_unref(value);
+  }
+}
+
+static GVariant*
+collection_get_property(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                        const gchar *interface_name, const gchar *property_name,
+                        GError **error, gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)error; (void)user_data;
+
+  if (strcmp(property_name, "Items") == 0) {
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    gpointer path;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("ao"));
+    g_hash_table_iter_init(&iter, items);
+    while (g_hash_table_iter_next(&iter, &path, NULL)) g_variant_builder_add(&builder, "o", path);
+    return g_variant_builder_end(&builder);
+  }
+  if (strcmp(property_name, "Label") == 0) return g_variant_new_string("Login");
+  if (strcmp(property_name, "Locked") == 0) return g_variant_new_boolean(FALSE);
+  return g_variant_new_uint64(0);
+}
+
+static void
+service_method_call(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                    const gchar *interface_name, const gchar *method_name,
+                    GVariant *parameters, GDBusMethodInvocation *invocation,
+                    gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)user_data;
+
+  if (strcmp(method_name, "OpenSession") == 0) {
+    const gchar *algorithm;
+    g_variant_get(parameters, "(&sv)", &algorithm, NULL);
+    if (strcmp(algorithm, "plain") != 0) {
+      g_dbus_method_invocation_return_dbus_error(
+        invocation, "org.freedesktop.DBus.Error.NotSupported", "only plain is supported");
+      return;
+    }
+    gchar *path = g_strdup_printf("%s/session/%u", SERVICE_PATH, ++next_session_id);
+    g_dbus_method_invocation_return_value(
+      invocation, g_variant_new("(@vo)", g_variant_new_variant(g_variant_new_string("")), path));
+    g_free(path);
+  }
+  else if (strcmp(method_name, "SearchItems") == 0) {
+    GVariant *query = g_variant_get_child_value(parameters, 0);
+    g_dbus_method_invocation_return_value(
+      invocation, g_variant_new("(@ao@ao)", search(query), g_variant_new("ao", NULL)));
+    g_variant_unref(query);
+  }
+  else if (strcmp(method_name, "Unlock") == 0 || strcmp(method_name, "Lock") == 0) {
+    GVariant *objects = g_variant_get_child_value(parameters, 0);
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(@ao@o)", objects,
+                                                                    g_variant_new_object_path("/")));
+  }
+  else if (strcmp(method_name, "GetSecrets") == 0) {
+    const gchar **paths, *session;
+    GVariantBuilder builder;
+
+    g_variant_get(parameters, "(^a&o&o)", &paths, &session);
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{o(oayays)}"));
+    for (int i = 0; paths[i]; i++) {
+      MockItem *item = g_hash_table_lookup(items, paths[i]);
+      if (item) g_variant_builder_add(&builder, "{o@(oayays)}", paths[i], secret_variant(item, session));
+    }
+    g_free(paths);
+    g_dbus_method_invocation_return_value(invocation, g_variant_new("(a{o(oayays)})", &builder));
+  }
+  else if (strcmp(method_name, "ReadAlias") == 0) {
+    const gchar *name;
+    g_variant_get(parameters, "(&s)", &name);
+    g_dbus_method_invocation_return_value(
+      invocation, g_variant_new("(o)", strcmp(name, "default") == 0 ? COLLECTION_PATH : "/"));
+  }
+}
+
+static GVariant*
+service_get_property(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                     const gchar *interface_name, const gchar *property_name,
+                     GError **error, gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)property_name;
+  (void)error; (void)user_data;
+
+  const gchar *collections[] = {COLLECTION_PATH, NULL};
+  return g_variant_new_objv(collections, -1);
+}
+
+static void
+session_method_call(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                    const gchar *interface_name, const gchar *method_name,
+                    GVariant *parameters, GDBusMethodInvocation *invocation,
+                    gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)method_name;
+  (void)parameters; (void)user_data;
+
+  g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static const GDBusInterfaceVTable service_vtable = {service_method_call, service_get_property, NULL, {0}};
+static const GDBusInterfaceVTable collection_vtable = {collection_method_call, collection_get_property, NULL, {0}};
+static const GDBusInterfaceVTable session_vtable = {session_method_call, NULL, NULL, {0}};
+
+static gchar**
+session_subtree_enumerate(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                          gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)user_data;
+  return g_new0(gchar*, 1);
+}
+
+static GDBusInterfaceInfo**
+session_subtree_introspect(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                           const gchar *node, gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)user_data;
+  GDBusInterfaceInfo **infos = g_new0(GDBusInterfaceInfo*, 2);
+  if (node != NULL) {
+    infos[0] = g_dbus_interface_info_ref(
+      g_dbus_node_info_lookup_interface(introspection, "org.freedesktop.Secret.Session"));
+  }
+  return infos;
+}
+
+static const GDBusInterfaceVTable*
+session_subtree_dispatch(GDBusConnection *conn, const gchar *sender, const gchar *object_path,
+                         const gchar *interface_name, const gchar *node,
+                         gpointer *out_user_data, gpointer user_data)
+{
+  (void)conn; (void)sender; (void)object_path; (void)interface_name; (void)node; (void)user_data;
+  *out_user_data = NULL;
+  return &session_vtable;
+}
+
+static const GDBusSubtreeVTable session_subtree_vtable = {
+  session_subtree_enumerate, session_subtree_introspect, session_subtree_dispatch, {0}
+};
+
+/* setup */
+
+static void
+seed(int namespaces, int keys, int value_size, int unrelated)
+{
+  gchar *value = g_malloc(value_size + 1);
+  for (int i = 0; i < value_size; i++) value[i] = 'a' + (i % 26);
+  value[value_size] = '\0';
+
+  for (int n = 0; n < namespaces; n++) {
+    for (int k = 0; k < keys; k++) {
+      GHashTable *attributes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+      gchar *key = g_strdup_printf("KEY_%d", k);
+      g_hash_table_insert(attributes, g_strdup("xdg:schema"), g_strdup(ENVCHAIN_SCHEMA));
+      g_hash_table_insert(attributes, g_strdup("name"), g_strdup_printf("bench-%d", n));
+      g_hash_table_insert(attributes, g_strdup("key"), key);
+      item_add(key, attributes, value, value_size, "text/plain");
+    }
+  }
+
+  for (int u = 0; u < unrelated; u++) {
+    GHashTable *attributes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_hash_table_insert(attributes, g_strdup("xdg:schema"), g_strdup("org.example.Unrelated"));
+    g_hash_table_insert(attributes, g_strdup("id"), g_strdup_printf("%d", u));
+    item_add("unrelated", attributes, value, value_size, "text/plain");
+  }
+
+  g_free(value);
+}
+
+static void
+on_bus_acquired(GDBusConnection *conn, const gchar *name, gpointer user_data)
+{
+  GHashTableIter iter;
+  gpointer item;
+  (void)name; (void)user_data;
+
+  connection = conn;
+  g_dbus_connection_register_object(
+    conn, SERVICE_PATH,
+    g_dbus_node_info_lookup_interface(introspection, "org.freedesktop.Secret.Service"),
+    &service_vtable, NULL, NULL, NULL);
+  g_dbus_connection_register_object(
+    conn, COLLECTION_PATH,
+    g_dbus_node_info_lookup_interface(introspection, "org.freedesktop.Secret.Collection"),
+    &collection_vtable, NULL, NULL, NULL);
+  g_dbus_connection_register_subtree(
+    conn, SERVICE_PATH "/session", &session_subtree_vtable,
+    G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES, NULL, NULL, NULL);
+
+  g_hash_table_iter_init(&iter, items);
+  while (g_hash_table_iter_next(&iter, NULL, &item)) item_register(item);
+}
+
+static void
+on_name_acquired(GDBusConnection *conn, const gchar *name, gpointer user_data)
+{
+  (void)conn; (void)name; (void)user_data;
+  printf("ready\n");
+  fflush(stdout);
+}
+
+static void
+on_name_lost(GDBusConnection *conn, const gchar *name, gpointer user_data)
+{
+  (void)conn; (void)user_data;
+  g_printerr("unable to own %s\n", name);
+  exit(1);
+}
+
+static gboolean
+on_terminate(gpointer loop)
+{
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+int
+main(int argc, char **argv)
+{
+  int namespaces = 10, keys = 10, value_size = 32, unrelated = 1000;
+  GMainLoop *loop;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--namespaces") == 0) namespaces = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--keys") == 0) keys = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--value-size") == 0) value_size = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--unrelated") == 0) unrelated = atoi(argv[i + 1]);
+    else {
+      g_printerr("unknown option: %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  introspection = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+  items = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, item_free);
+  seed(namespaces, keys, value_size, unrelated);
+
+  loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGTERM, on_terminate, loop);
+  g_unix_signal_add(SIGINT, on_terminate, loop);
+
+  g_bus_own_name(G_BUS_TYPE_SESSION, "org.freedesktop.secrets",
+                 G_BUS_NAME_OWNER_FLAGS_REPLACE, on_bus_acquired, on_name_acquired,
+                 on_name_lost, NULL, NULL);
+  g_main_loop_run(loop);
+
+  g_main_loop_unref(loop);
+  return 0;
+}
@@ -0,0 +1,107 @@
+#!/bin/sh
+# Latency benchmark for envchain against bench/mock-secret-service.
+#
+# Meant to be run inside a private session bus, e.g. via `make bench`:
+#
+#   dbus-run-session -- sh bench/run.sh
+#
+# Tunables (environment):
+#   BENCH_ITERATIONS   runs per scenario           (default 50)
+#   BENCH_NAMESPACES   seeded namespaces           (default 10)
+#   BENCH_KEYS         keys per namespace          (default 10)
+#   BENCH_VALUE_SIZE   bytes per value             (default 32)
+#   BENCH_UNRELATED    non-envchain items          (default 1000)
+#   ENVCHAIN           binary under test           (default ./envchain)
+#   MOCK               mock service binary         (default bench/mock-secret-service)
+
+set -e
+
+: "${BENCH_ITERATIONS:=50}"
+: "${BENCH_NAMESPACES:=10}"
+: "${BENCH_KEYS:=10}"
+: "${BENCH_VALUE_SIZE:=32}"
+: "${BENCH_UNRELATED:=1000}"
+: "${ENVCHAIN:=./envchain}"
+: "${MOCK:=bench/mock-secret-service}"
+
+if [ -z "$DBUS_SESSION_BUS_ADDRESS" ]; then
+  echo "bench/run.sh: no session bus; run it under dbus-run-session" >&2
+  exit 1
+fi
+
+workdir="$(mktemp -d)"
+mock_pid=
+cleanup() {
+  [ -n "$mock_pid" ] && kill "$mock_pid" 2>/dev/null
+  rm -rf "$workdir"
+}
+trap cleanup EXIT INT TERM
+
+mkfifo "$workdir/ready"
+"$MOCK" --namespaces "$BENCH_NAMESPACES" --keys "$BENCH_KEYS" \
+  --value-size "$BENCH_VALUE_SIZE" --unrelated "$BENCH_UNRELATED" >"$workdir/ready" &
+mock_pid=$!
+read -r _ <"$workdir/ready"
+
+# Keep the agent and tracing out of the measurements
+unset ENVCHAIN_AGENT_SOCK ENVCHAIN_TRACE
+
+now_ns() {
+  date +%s%N
+}
+
+# bench LABEL COMMAND...: runs COMMAND $BENCH_ITERATIONS times and prints percentiles
+bench() {
+  label="$1"
+  shift
+  : >"$workdir/samples"
+  i=0
+  while [ "$i" -lt "$BENCH_ITERATIONS" ]; do
+    start="$(now_ns)"
+    "$@" >/dev/null
+    end="$(now_ns)"
+    echo $(((end - start) / 1000)) >>"$workdir/samples"
+    i=$((i + 1))
+  done
+  sort -n "$workdir/samples" | awk -v label="$label" '
+    { v[NR] = $1 }
+    function pct(p,  i) { i = int(NR * p / 100 + 0.999); if (i < 1) i = 1; return v[i] / 1000 }
+    END { printf "%-24s %10.2f %10.2f %10.2f %10.2f\n", label, pct(50), pct(90), pct(99), v[NR] / 1000 }'
+}
+
+set_one() {
+  printf 'value\n' | "$ENVCHAIN" --set bench-set KEY_0
+}
+
+import_all() {
+  "$ENVCHAIN" --set --import bench-set <"$workdir/import"
+}
+
+unset_one() {
+  set_one
+  "$ENVCHAIN" --unset bench-set KEY_0
+}
+
+i=0
+: >"$workdir/import"
+while [ "$i" -lt "$BENCH_KEYS" ]; do
+  echo "KEY_$i=value-$i" >>"$workdir/import"
+  i=$((i + 1))
+done
+
+multi="bench-0"
+i=1
+while [ "$i" -lt "$BENCH_NAMESPACES" ] && [ "$i" -lt 5 ]; do
+  multi="$multi,bench-$i"
+  i=$((i + 1))
+done
+
+echo "namespaces=$BENCH_NAMESPACES keys=$BENCH_KEYS value_size=$BENCH_VALUE_SIZE unrelated=$BENCH_UNRELATED iterations=$BENCH_ITERATIONS"
+printf "%-24s %10s %10s %10s %10s\n" "scenario (ms)" p50 p90 p99 max
+bench "exec" "$ENVCHAIN" bench-0 true
+bench "exec ($multi)" "$ENVCHAIN" "$multi" true
+bench "list" "$ENVCHAIN" --list
+bench "list bench-0" "$ENVCHAIN" --list bench-0
+bench "set" set_one
+bench "set --import" import_all
+bench "set + unset" unset_one
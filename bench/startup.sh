@@ -0,0 +1,61 @@
+#!/bin/sh
+# Startup benchmark for envchain: exec mode against a small vault, so no
+# keyring or session bus is involved and process startup dominates.
+#
+#   make bench-startup
+#
+# Tunables (environment):
+#   BENCH_ITERATIONS   runs per scenario           (default 200)
+#   ENVCHAIN           binary under test           (default ./envchain)
+
+set -e
+
+: "${BENCH_ITERATIONS:=200}"
+: "${ENVCHAIN:=./envchain}"
+
+workdir="$(mktemp -d)"
+cleanup() {
+  rm -rf "$workdir"
+}
+trap cleanup EXIT INT TERM
+
+unset ENVCHAIN_AGENT_SOCK ENVCHAIN_TRACE ENVCHAIN_COALESCE
+ENVCHAIN_BACKEND=vault
+ENVCHAIN_VAULT="$workdir/vault"
+ENVCHAIN_VAULT_KEY="$workdir/vault.key"
+export ENVCHAIN_BACKEND ENVCHAIN_VAULT ENVCHAIN_VAULT_KEY
+
+printf 'KEY_0=value-0\nKEY_1=value-1\n' | "$ENVCHAIN" --set --import bench-startup 2>/dev/null
+
+now_ns() {
+  date +%s%N
+}
+
+# bench LABEL COMMAND...: runs COMMAND $BENCH_ITERATIONS times and prints percentiles
+bench() {
+  label="$1"
+  shift
+  : >"$workdir/samples"
+  i=0
+  while [ "$i" -lt "$BENCH_ITERATIONS" ]; do
+    start="$(now_ns)"
+    "$@" >/dev/null 2>&1 || true
+    end="$(now_ns)"
+    echo $(((end - start) / 1000)) >>"$workdir/samples"
+    i=$((i + 1))
+  done
+  sort -n "$workdir/samples" | awk -v label="$label" '
+    { v[NR] = $1 }
+    function pct(p,  i) { i = int(NR * p / 100 + 0.999); if (i < 1) i = 1; return v[i] / 1000 }
+    END { printf "%-24s %10.2f %10.2f %10.2f %10.2f\n", label, pct(50), pct(90), pct(99), v[NR] / 1000 }'
+}
+
+if command -v ldd >/dev/null 2>&1; then
+  echo "shared libraries: $(ldd "$ENVCHAIN" | wc -l)"
+fi
+echo "iterations=$BENCH_ITERATIONS"
+printf "%-24s %10s %10s %10s %10s\n" "scenario (ms)" p50 p90 p99 max
+bench "env true (baseline)" env true
+bench "help" "$ENVCHAIN"
+bench "exec" "$ENVCHAIN" bench-startup true
+bench "exec KEY_1" "$ENVCHAIN" bench-startup:KEY_1 true
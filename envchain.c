@@ -33,8 +33,14 @@
 #include <termios.h>
 #include <assert.h>
 #include <errno.h>
-
-#include <readline/readline.h>
+#include <signal.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <dlfcn.h>
 
 #include "envchain.h"
 
@@ -53,12 +59,38 @@ envchain_abort_with_help(void)
     "Usage:\n"
     "  Add variables\n"
     "    %s (--set|-s) [--[no-]require-passphrase|-p|-P] [--noecho|-n] NAMESPACE ENV [ENV ..]\n"
+    "  Add variables from KEY=VALUE lines or NDJSON objects on stdin\n"
+    "    %s (--set|-s) --import [--[no-]require-passphrase|-p|-P] NAMESPACE\n"
+    "  Add a variable from the raw bytes on stdin\n"
+    "    %s (--set|-s) --stdin [--[no-]require-passphrase|-p|-P] NAMESPACE ENV\n"
     "  Execute with variables\n"
-    "    %s NAMESPACE CMD [ARG ...]\n"
+    "    %s [--fd=ENV,..] [--fd-threshold=BYTES] NAMESPACE[:ENV,..][,NAMESPACE[:ENV,..] ..] CMD [ARG ...]\n"
     "  List namespaces\n"
     "    %s --list\n"
-    "  Remove variables\n"
-    "    %s --unset NAMESPACE ENV [ENV ..]\n"
+    "  List every namespace with its keys and their count\n"
+    "    %s --list --all [--format=text|json]\n"
+    "  Remove variables, or every variable of the namespaces; NAMESPACE may be a glob\n"
+    "    %s --unset NAMESPACE (ENV [ENV ..]|--all)\n"
+    "  Copy a namespace, merge namespaces into one, or rename a namespace\n"
+    "    %s (--copy SRC|--merge SRC[,SRC ..]|--rename SRC) [--on-conflict=error|overwrite|skip] DST\n"
+    "  Run each command line read from stdin with variables, fetched once\n"
+    "    %s --each [-j N] [-0] NAMESPACE[,NAMESPACE ..] < COMMANDS\n"
+    "  Execute with variables, restarting CMD when they change\n"
+    "    %s --watch [--signal=SIG] NAMESPACE[:ENV,..][,NAMESPACE[:ENV,..] ..] CMD [ARG ...]\n"
+    "  Print variables for eval or other tools\n"
+    "    %s --export [--format=sh|dotenv|json|nul] NAMESPACE[:ENV,..][,NAMESPACE[:ENV,..] ..]\n"
+    "  Write an encrypted bundle of namespaces to stdout\n"
+    "    %s --seal [--key-file FILE] NAMESPACE[,NAMESPACE ..] > BUNDLE\n"
+    "  Execute with variables from a bundle\n"
+    "    %s --from-bundle BUNDLE [--key-file FILE] NAMESPACE[,NAMESPACE ..] CMD [ARG ...]\n"
+    "  Start an agent caching namespaces for exec mode\n"
+    "    %s --agent [--ttl SECONDS] [--socket PATH] [--foreground|-f]\n"
+    ,
+    envchain_name, version, envchain_name, envchain_name, envchain_name, envchain_name, envchain_name, envchain_name,
+    envchain_name, envchain_name, envchain_name, envchain_name, envchain_name, envchain_name, envchain_name, envchain_name
+  );
+  /* split from the above to stay within the string literal length C99 guarantees */
+  fputs(
     "\n"
     "Options:\n"
     "  --set (-s):\n"
@@ -70,12 +102,129 @@ envchain_abort_with_help(void)
     "  --require-passphrase (-p), --no-require-passphrase (-P):\n"
     "    Replace the item's ACL list to require passphrase (or not).\n"
     "    Leave as is when both options are omitted.\n"
-    ,
-    envchain_name, version, envchain_name, envchain_name, envchain_name, envchain_name
+    "\n"
+    "  NAMESPACE:ENV,..:\n"
+    "    In exec mode, fetch only the listed variables of NAMESPACE. Follow with\n"
+    "    NAMESPACE: (or NAMESPACE:ENV,..) to add another namespace. NAMESPACE may\n"
+    "    be a glob, replaced by the namespaces it matches in sorted order. A\n"
+    "    namespace also named explicitly, or matched by several globs, gets the\n"
+    "    variables of all of them, where it is named or else at the first glob.\n"
+    "\n"
+    "  --fd=ENV,.., --fd-threshold=BYTES:\n"
+    "    In exec mode, pass the listed variables, and those longer than BYTES, in\n"
+    "    sealed memory files inherited by CMD; the variable holds /proc/self/fd/N.\n"
+    "    Values containing NUL bytes are always passed this way. Linux only.\n"
+    "\n"
+    "  --trace, --trace=FILE:\n"
+    "    Given before any other option, write a JSON summary of time spent per\n"
+    "    phase to stderr or FILE. Also enabled by ENVCHAIN_TRACE=1 or ENVCHAIN_TRACE=FILE.\n"
+    "\n"
+    "  --agent:\n"
+    "    Serve namespaces to exec mode over a Unix socket, caching them for\n"
+    "    +SECONDS+ (default 300). Exec mode asks the agent when\n"
+    "    ENVCHAIN_AGENT_SOCK is set, and falls back to the keychain otherwise.\n"
+    "\n"
+    "  --copy, --merge, --rename:\n"
+    "    Sources are read in one pass and DST is written in one batch. Variables\n"
+    "    DST has already are an error unless --on-conflict says otherwise. Where\n"
+    "    the backend allows, --rename changes only the items' attributes.\n"
+    "\n"
+    "  --each:\n"
+    "    Run each line (NUL-terminated with -0) with sh -c, at most N at a time\n"
+    "    (default 1). Exits with the highest status of the commands, 128+SIGNAL\n"
+    "    for commands killed by a signal.\n"
+    "\n"
+    "  --watch:\n"
+    "    Run CMD as a child instead of exec'ing it. When selected items are\n"
+    "    created, changed or deleted, only those are fetched again, CMD is sent\n"
+    "    SIG (default TERM) and started again with the new values once it exits.\n"
+    "    Otherwise exits with CMD's status. Secret Service backend only.\n"
+    "\n"
+    "  --export:\n"
+    "    Print variables as sh export statements (default), dotenv lines, one\n"
+    "    JSON object (readable by --set --import), or NUL-terminated KEY=VALUE.\n"
+    "    JSON keeps values with NUL bytes but skips those that aren't UTF-8.\n"
+    "    Variables of later namespaces are printed last.\n"
+    "\n"
+    "  --seal, --from-bundle:\n"
+    "    Bundles use the vault format, encrypted with the hex key in --key-file or\n"
+    "    ENVCHAIN_BUNDLE_KEY_FILE (created by --seal when missing). --from-bundle\n"
+    "    reads only the bundle, without a keychain, D-Bus session or agent.\n"
+    "\n"
+    "Environment:\n"
+    "  ENVCHAIN_BACKEND:\n"
+    "    keychain (macOS) or secret-service (Linux) by default, or vault to keep\n"
+    "    values in the encrypted file ENVCHAIN_VAULT with the key in ENVCHAIN_VAULT_KEY.\n"
+    "  ENVCHAIN_COALESCE:\n"
+    "    Set to 1 to let concurrent exec mode invocations for the same namespaces\n"
+    "    share one fetch, reused for ENVCHAIN_COALESCE_LINGER_MS (default 100).\n",
+    stderr
   );
   exit(2);
 }
 
+/* key lists */
+
+typedef struct {
+  char **keys;
+  int count;
+  int capacity;
+} envchain_key_list;
+
+static int
+envchain_key_list_has(const envchain_key_list *list, const char *key)
+{
+  for (int i = 0; i < list->count; i++) {
+    if (strcmp(list->keys[i], key) == 0) return 1;
+  }
+  return 0;
+}
+
+/* Adds a copy of key unless it is already listed */
+static void
+envchain_key_list_add(envchain_key_list *list, const char *key)
+{
+  if (envchain_key_list_has(list, key)) return;
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 8;
+    list->keys = realloc(list->keys, sizeof(char*) * list->capacity);
+    if (list->keys == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+  list->keys[list->count] = strdup(key);
+  if (list->keys[list->count] == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  list->count++;
+}
+
+static void
+envchain_key_list_clear(envchain_key_list *list)
+{
+  for (int i = 0; i < list->count; i++) free(list->keys[i]);
+  list->count = 0;
+}
+
+static void
+envchain_key_list_free(envchain_key_list *list)
+{
+  envchain_key_list_clear(list);
+  free(list->keys);
+  list->keys = NULL;
+  list->capacity = 0;
+}
+
+/* envchain_key_match_callback selecting the keys of the list given as data */
+static int
+envchain_key_list_match(const char *name, const char *key, void *data)
+{
+  (void)name;
+  return envchain_key_list_has((const envchain_key_list*)data, key);
+}
+
 /* functions for --set */
 
 char*
@@ -119,6 +268,54 @@ envchain_noecho_read(char* prompt)
   return str;
 }
 
+/*
+ * readline is only needed for prompting in --set, so it is loaded on first
+ * use instead of being linked, keeping exec mode startup lean.
+ */
+static const char *envchain_readline_libraries[] = {
+#ifdef __APPLE__
+  "libedit.3.dylib", "libedit.dylib",
+#else
+  "libreadline.so.8", "libreadline.so.7", "libreadline.so.6", "libreadline.so",
+#endif
+  NULL
+};
+
+static char*
+envchain_readline(const char *prompt)
+{
+  static char *(*readline_function)(const char*) = NULL;
+  static int loaded = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+
+  if (!loaded) {
+    loaded = 1;
+    for (int i = 0; envchain_readline_libraries[i] && readline_function == NULL; i++) {
+      void *handle = dlopen(envchain_readline_libraries[i], RTLD_NOW | RTLD_LOCAL);
+      if (handle == NULL) continue;
+      void *symbol = dlsym(handle, "readline");
+      if (symbol == NULL) {
+        dlclose(handle);
+        continue;
+      }
+      memcpy(&readline_function, &symbol, sizeof(readline_function));
+    }
+  }
+  if (readline_function) return readline_function(prompt);
+
+  /* no readline available; read a plain line */
+  fputs(prompt, stdout);
+  fflush(stdout);
+  len = getline(&line, &line_cap, stdin);
+  if (len < 0) {
+    free(line);
+    return NULL;
+  }
+  if (0 < len && line[len - 1] == '\n') line[len - 1] = '\0';
+  return line;
+}
 
 static char*
 envchain_ask_value(const char* name, const char* key, int noecho)
@@ -131,28 +328,81 @@ envchain_ask_value(const char* name, const char* key, int noecho)
   }
   else {
     printf("%s", prompt);
-    line = readline(": ");
+    line = envchain_readline(": ");
   }
 
   free(prompt);
   return line;
 }
 
+/* --set --stdin: the value is stdin as is, NULs and trailing newlines included */
+static int
+envchain_set_from_stdin(const char *name, const char *key, int require_passphrase)
+{
+  size_t len = 0, cap = 4096;
+  char *value = malloc(cap), *grown;
+  size_t n;
+  int failures;
+
+  if (value == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  while ((n = fread(value + len, 1, cap - len, stdin)) > 0) {
+    len += n;
+    if (len < cap) continue;
+
+    /* grow by copying, so no stray copy of the value is left behind by realloc */
+    grown = malloc(cap * 2);
+    if (grown == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+    memcpy(grown, value, len);
+    memset(value, 0, cap);
+    free(value);
+    value = grown;
+    cap *= 2;
+  }
+  if (ferror(stdin)) {
+    fprintf(stderr, "%s: reading stdin failed: %s\n", envchain_name, strerror(errno));
+    memset(value, 0, cap);
+    free(value);
+    return 1;
+  }
+
+  const char *v = value;
+  failures = envchain_save_values(name, &key, &v, &len, 1, require_passphrase);
+  memset(value, 0, cap);
+  free(value);
+  return failures ? 1 : 0;
+}
+
 int
 envchain_set(int argc, const char **argv)
 {
   int noecho = 0;
+  int import = 0;
   int require_passphrase = -1;
+  int raw_stdin = 0;
   const char *name, *key;
   char *value;
 
-  while (2 < argc) {
+  while (1 < argc) {
     if (argv[0][0] != '-') break;
 
     if (strcmp(argv[0], "-n") == 0 || strcmp(argv[0], "--noecho") == 0) {
       argv++; argc--;
       noecho = 1;
     }
+    else if (strcmp(argv[0], "--import") == 0) {
+      argv++; argc--;
+      import = 1;
+    }
+    else if (strcmp(argv[0], "--stdin") == 0) {
+      argv++; argc--;
+      raw_stdin = 1;
+    }
     else if (strcmp(argv[0], "-p") == 0 || strcmp(argv[0], "--require-passphrase") == 0) {
       argv++; argc--;
       require_passphrase = 1;
@@ -166,6 +416,14 @@ envchain_set(int argc, const char **argv)
       return 1;
     }
   }
+  if (import) {
+    if (argc != 1) envchain_abort_with_help();
+    return envchain_import(argv[0], stdin, require_passphrase);
+  }
+  if (raw_stdin) {
+    if (argc != 2) envchain_abort_with_help();
+    return envchain_set_from_stdin(argv[0], argv[1], require_passphrase);
+  }
   if (argc < 2) envchain_abort_with_help();
 
   name = argv[0];
@@ -186,13 +444,81 @@ envchain_set(int argc, const char **argv)
 
 /* functions for list */
 
+/* Length of the well-formed UTF-8 sequence at str, or 0 */
+static size_t
+envchain_utf8_sequence_len(const unsigned char *str, size_t len)
+{
+  size_t n;
+  uint32_t cp;
+
+  if (str[0] < 0x80) return 1;
+  if (str[0] < 0xc2) return 0;
+  if (str[0] < 0xe0) { n = 2; cp = str[0] & 0x1f; }
+  else if (str[0] < 0xf0) { n = 3; cp = str[0] & 0x0f; }
+  else if (str[0] < 0xf5) { n = 4; cp = str[0] & 0x07; }
+  else return 0;
+
+  if (len < n) return 0;
+  for (size_t i = 1; i < n; i++) {
+    if ((str[i] & 0xc0) != 0x80) return 0;
+    cp = (cp << 6) | (str[i] & 0x3f);
+  }
+  /* overlong forms, surrogates and code points past U+10FFFF */
+  if ((n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000) || (0xd800 <= cp && cp <= 0xdfff) || 0x10ffff < cp)
+    return 0;
+  return n;
+}
+
+static int
+envchain_is_utf8(const char *str, size_t len)
+{
+  for (size_t i = 0, n; i < len; i += n) {
+    n = envchain_utf8_sequence_len((const unsigned char*)str + i, len - i);
+    if (n == 0) return 0;
+  }
+  return 1;
+}
+
+/*
+ * The reverse of envchain_import_json_string. UTF-8 is passed through; bytes
+ * that aren't part of it are written as U+FFFD, so the output is always JSON.
+ */
 static void
-envchain_list_value_callback(const char *key, const char* value, void *raw_context)
+envchain_print_json_string(const char *str, size_t len)
+{
+  putchar('"');
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = str[i];
+    if (0x80 <= c) {
+      size_t n = envchain_utf8_sequence_len((const unsigned char*)str + i, len - i);
+      if (n == 0) fputs("\\ufffd", stdout);
+      else fwrite(str + i, 1, n, stdout);
+      if (0 < n) i += n - 1;
+      continue;
+    }
+    switch (c) {
+      case '"': fputs("\\\"", stdout); break;
+      case '\\': fputs("\\\\", stdout); break;
+      case '\n': fputs("\\n", stdout); break;
+      case '\r': fputs("\\r", stdout); break;
+      case '\t': fputs("\\t", stdout); break;
+      default:
+        if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+static void
+envchain_list_value_callback(const char *key, const char* value, size_t value_len, void *raw_context)
 {
   envchain_list_context* context = (envchain_list_context*)raw_context;
 
   if (context->show_value) {
-    printf("%s=%s\n", key, value);
+    printf("%s=", key);
+    fwrite(value, 1, value_len, stdout);
+    printf("\n");
   }
   else {
     printf("%s\n", key);
@@ -207,16 +533,119 @@ envchain_list_namespace_callback(const char *name, void *raw_context)
   printf("%s\n", name);
 }
 
+typedef struct {
+  char *name;
+  char *key;
+} envchain_list_item;
+
+typedef struct {
+  envchain_list_item *items;
+  size_t count;
+  size_t capacity;
+} envchain_list_all_context;
+
+static void
+envchain_list_key_callback(const char *name, const char *key, void *raw_context)
+{
+  envchain_list_all_context *context = raw_context;
+
+  if (context->count == context->capacity) {
+    context->capacity = context->capacity ? context->capacity * 2 : 64;
+    context->items = realloc(context->items, sizeof(envchain_list_item) * context->capacity);
+    if (context->items == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+  context->items[context->count].name = strdup(name);
+  context->items[context->count].key = strdup(key);
+  context->count++;
+}
+
+static int
+envchain_list_item_cmp(const void *a, const void *b)
+{
+  const envchain_list_item *x = a, *y = b;
+  int cmp = strcmp(x->name, y->name);
+  return cmp != 0 ? cmp : strcmp(x->key, y->key);
+}
+
+/* Every namespace with its keys from one search, without loading any secret */
+static int
+envchain_list_all(int json)
+{
+  envchain_list_all_context context = {NULL, 0, 0};
+  envchain_list_item *items;
+  size_t i, j, end, count;
+
+  if (envchain_search_keys(&envchain_list_key_callback, &context) != 0) {
+    for (i = 0; i < context.count; i++) {
+      free(context.items[i].name);
+      free(context.items[i].key);
+    }
+    free(context.items);
+    return 1;
+  }
+  items = context.items;
+  if (0 < context.count) qsort(items, context.count, sizeof(envchain_list_item), &envchain_list_item_cmp);
+
+  if (json) putchar('{');
+  for (i = 0; i < context.count; i = end) {
+    /* a keyring may hold the same item twice; each key is listed once */
+    count = 1;
+    for (end = i + 1; end < context.count && strcmp(items[end].name, items[i].name) == 0; end++) {
+      if (strcmp(items[end].key, items[end - 1].key) != 0) count++;
+    }
+
+    if (json) {
+      if (0 < i) putchar(',');
+      envchain_print_json_string(items[i].name, strlen(items[i].name));
+      printf(":{\"count\":%zu,\"keys\":[", count);
+    }
+    else {
+      printf("%s (%zu)\n", items[i].name, count);
+    }
+    for (j = i; j < end; j++) {
+      if (j > i && strcmp(items[j].key, items[j - 1].key) == 0) continue;
+      if (json) {
+        if (j > i) putchar(',');
+        envchain_print_json_string(items[j].key, strlen(items[j].key));
+      }
+      else {
+        printf("  %s\n", items[j].key);
+      }
+    }
+    if (json) printf("]}");
+  }
+  if (json) printf("}\n");
+
+  for (i = 0; i < context.count; i++) {
+    free(items[i].name);
+    free(items[i].key);
+  }
+  free(items);
+  return 0;
+}
+
 int
 envchain_list(int argc, const char **argv)
 {
   envchain_list_context context = {NULL,0};
+  int all = 0, json = 0;
 
   while (0 < argc) {
     if (strcmp(argv[0], "--show-value") == 0 || strcmp(argv[0], "-v") == 0) {
       argv++; argc--;
       context.show_value = 1;
     }
+    else if (strcmp(argv[0], "--all") == 0 || strcmp(argv[0], "-a") == 0) {
+      argv++; argc--;
+      all = 1;
+    }
+    else if (strcmp(argv[0], "--format=json") == 0 || strcmp(argv[0], "--format=text") == 0) {
+      json = argv[0][9] == 'j';
+      argv++; argc--;
+    }
     else {
       if (context.target) envchain_abort_with_help();
       context.target = argv[0];
@@ -224,6 +653,12 @@ envchain_list(int argc, const char **argv)
     }
   }
 
+  if (all) {
+    if (context.target || context.show_value) envchain_abort_with_help();
+    return envchain_list_all(json);
+  }
+  if (json) envchain_abort_with_help();
+
   if (context.target) {
     envchain_search_values(
       context.target, &envchain_list_value_callback, &context);
@@ -238,92 +673,1216 @@ envchain_list(int argc, const char **argv)
 
 /* functions for --unset */
 
+typedef struct {
+  const char *name; /* may be a glob */
+  int name_is_glob;
+  const char **keys; /* NULL for --all */
+  int keys_count;
+  int *matched; /* per key, or [0] for --all */
+} envchain_unset_context;
+
+static int
+envchain_unset_match(const char *name, const char *key, void *raw_context)
+{
+  envchain_unset_context *context = raw_context;
+  int selected = 0;
+
+  if (context->name_is_glob ? fnmatch(context->name, name, 0) != 0 : strcmp(context->name, name) != 0) return 0;
+  if (context->keys == NULL) {
+    context->matched[0] = 1;
+    return 1;
+  }
+  for (int i = 0; i < context->keys_count; i++) {
+    if (strcmp(context->keys[i], key) == 0) context->matched[i] = selected = 1;
+  }
+  return selected;
+}
+
 int
 envchain_unset(int argc, const char **argv)
 {
-  const char *name, *key;
+  envchain_unset_context context = {NULL, 0, NULL, 0, NULL};
+  int all = 0, result;
 
   if (argc < 2) envchain_abort_with_help();
 
-  name = argv[0];
+  context.name = argv[0];
+  context.name_is_glob = envchain_is_glob(context.name);
   argv++; argc--;
 
+  if (strcmp(argv[0], "--all") == 0) {
+    if (argc != 1) envchain_abort_with_help();
+    all = 1;
+  }
+  else {
+    context.keys = argv;
+    context.keys_count = argc;
+  }
+  context.matched = calloc(all ? 1 : argc, sizeof(int));
+  if (context.matched == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+
+  /* one search for every item of the namespace(s), then a batch of deletes */
+  result = envchain_delete_values(context.name_is_glob ? NULL : context.name,
+                                  &envchain_unset_match, &context);
+
+  if (0 <= result) {
+    for (int i = 0; i < (all ? 1 : context.keys_count); i++) {
+      if (context.matched[i]) continue;
+      if (all) fprintf(stderr, "WARNING: nothing matched `%s`.\n", context.name);
+      else fprintf(stderr, "WARNING: nothing matched `%s:%s`.\n", context.name, context.keys[i]);
+    }
+  }
+  free(context.matched);
+  return result != 0;
+}
+
+/* functions for --copy, --merge and --rename */
+
+typedef enum {
+  ENVCHAIN_COPY,
+  ENVCHAIN_MERGE,
+  ENVCHAIN_RENAME
+} envchain_copy_mode;
+
+typedef enum {
+  ENVCHAIN_CONFLICT_ERROR,
+  ENVCHAIN_CONFLICT_OVERWRITE,
+  ENVCHAIN_CONFLICT_SKIP
+} envchain_conflict_policy;
+
+static const char *envchain_conflict_policy_names[] = {"error", "overwrite", "skip", NULL};
+
+typedef struct {
+  const char *src; /* NULL when only dst is needed */
+  const char *dst;
+  envchain_key_list src_keys;
+  envchain_key_list dst_keys;
+} envchain_copy_keys_context;
+
+static void
+envchain_copy_keys_callback(const char *name, const char *key, void *raw_context)
+{
+  envchain_copy_keys_context *context = raw_context;
+
+  if (context->src && strcmp(name, context->src) == 0) envchain_key_list_add(&context->src_keys, key);
+  if (strcmp(name, context->dst) == 0) envchain_key_list_add(&context->dst_keys, key);
+}
+
+typedef struct {
+  const char **keys;
+  const char **values; /* point into the env's entries */
+  size_t *value_lens;
+  int count;
+  int capacity;
+  const envchain_key_list *existing;
+  envchain_conflict_policy policy;
+  envchain_key_list conflicts;
+} envchain_copy_context;
+
+static void
+envchain_copy_value_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_copy_context *context = raw_context;
+
+  if (envchain_key_list_has(context->existing, key)) {
+    if (context->policy == ENVCHAIN_CONFLICT_SKIP) return;
+    if (context->policy == ENVCHAIN_CONFLICT_ERROR) {
+      envchain_key_list_add(&context->conflicts, key);
+      return;
+    }
+  }
+
+  if (context->count == context->capacity) {
+    context->capacity = context->capacity ? context->capacity * 2 : 32;
+    context->keys = realloc(context->keys, sizeof(char*) * context->capacity);
+    context->values = realloc(context->values, sizeof(char*) * context->capacity);
+    context->value_lens = realloc(context->value_lens, sizeof(size_t) * context->capacity);
+    if (context->keys == NULL || context->values == NULL || context->value_lens == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+  context->keys[context->count] = strdup(key);
+  context->values[context->count] = value;
+  context->value_lens[context->count] = value_len;
+  context->count++;
+}
+
+static void
+envchain_copy_collect_callback(const char *key, const char *value, size_t value_len, void *env)
+{
+  envchain_env_set((envchain_env*)env, key, value, value_len);
+}
+
+static void
+envchain_copy_report_conflicts(const char *dst, const envchain_key_list *conflicts)
+{
+  for (int i = 0; i < conflicts->count; i++) {
+    fprintf(stderr, "%s: `%s:%s' already exists\n", envchain_name, dst, conflicts->keys[i]);
+  }
+  fprintf(stderr, "%s: nothing was changed; use --on-conflict=overwrite or --on-conflict=skip\n",
+          envchain_name);
+}
+
+/* Stores the values of env into dst with one batch of stores; non-zero on failure */
+static int
+envchain_copy_store(envchain_env *env, const char *dst, const envchain_key_list *existing,
+                    envchain_conflict_policy policy)
+{
+  envchain_copy_context context = {NULL, NULL, NULL, 0, 0, existing, policy, {NULL, 0, 0}};
+  int result = 0;
+
+  envchain_env_foreach(env, &envchain_copy_value_callback, &context);
+  if (0 < context.conflicts.count) {
+    envchain_copy_report_conflicts(dst, &context.conflicts);
+    result = 1;
+  }
+  else if (0 < context.count) {
+    result = envchain_save_values(dst, context.keys, context.values, context.value_lens, context.count, -1) != 0;
+  }
+
+  for (int i = 0; i < context.count; i++) free((char*)context.keys[i]);
+  free(context.keys);
+  free(context.values);
+  free(context.value_lens);
+  envchain_key_list_free(&context.conflicts);
+  return result;
+}
+
+static int
+envchain_rename(const char *src, const char *dst, envchain_conflict_policy policy)
+{
+  envchain_copy_keys_context keys = {src, dst, {NULL, 0, 0}, {NULL, 0, 0}};
+  envchain_key_list conflicts = {NULL, 0, 0}, moved = {NULL, 0, 0};
+  const envchain_backend *backend = envchain_backend_get();
+  int result = 1;
+
+  /* one search tells both what to move and what is in the way */
+  if (envchain_search_keys(&envchain_copy_keys_callback, &keys) != 0) goto ensure;
+  if (keys.src_keys.count == 0) {
+    fprintf(stderr, "WARNING: namespace `%s` not defined.\n", src);
+    goto ensure;
+  }
+  for (int i = 0; i < keys.src_keys.count; i++) {
+    const char *key = keys.src_keys.keys[i];
+    if (envchain_key_list_has(&keys.dst_keys, key)) {
+      envchain_key_list_add(&conflicts, key);
+      if (policy == ENVCHAIN_CONFLICT_SKIP) continue;
+    }
+    envchain_key_list_add(&moved, key);
+  }
+
+  if (0 < conflicts.count && policy == ENVCHAIN_CONFLICT_ERROR) {
+    envchain_copy_report_conflicts(dst, &conflicts);
+    goto ensure;
+  }
+  if (0 < conflicts.count && policy == ENVCHAIN_CONFLICT_OVERWRITE &&
+      envchain_delete_values(dst, &envchain_key_list_match, &conflicts) != 0) {
+    goto ensure;
+  }
+  if (moved.count == 0) {
+    result = 0;
+    goto ensure;
+  }
+
+  if (backend->rename_values) {
+    result = backend->rename_values(src, dst, &envchain_key_list_match, &moved) != 0;
+  }
+  else {
+    /* copy, then delete the originals once the copies are stored */
+    envchain_selector selector = {src, (const char**)moved.keys, moved.count};
+    envchain_env *env = envchain_env_new();
+    if (envchain_search_values_multi(&selector, 1, &envchain_copy_collect_callback, env) == 0 &&
+        envchain_copy_store(env, dst, &keys.dst_keys, ENVCHAIN_CONFLICT_OVERWRITE) == 0) {
+      result = envchain_delete_values(src, &envchain_key_list_match, &moved) != 0;
+    }
+    envchain_env_free(env);
+  }
+
+ensure:
+  envchain_key_list_free(&keys.src_keys);
+  envchain_key_list_free(&keys.dst_keys);
+  envchain_key_list_free(&conflicts);
+  envchain_key_list_free(&moved);
+  return result;
+}
+
+int
+envchain_copy(int argc, const char **argv, envchain_copy_mode mode)
+{
+  envchain_conflict_policy policy = ENVCHAIN_CONFLICT_ERROR;
+  envchain_copy_keys_context keys = {NULL, NULL, {NULL, 0, 0}, {NULL, 0, 0}};
+  envchain_selector *selectors;
+  envchain_env *env;
+  const char *args[2];
+  int args_count = 0, selectors_count = 0, result = 1;
+
   while (0 < argc) {
-    key = argv[0];
+    if (strncmp(argv[0], "--on-conflict=", 14) == 0) {
+      int i;
+      for (i = 0; envchain_conflict_policy_names[i]; i++) {
+        if (strcmp(argv[0] + 14, envchain_conflict_policy_names[i]) == 0) break;
+      }
+      if (envchain_conflict_policy_names[i] == NULL) envchain_abort_with_help();
+      policy = (envchain_conflict_policy)i;
+    }
+    else if (argv[0][0] == '-' || args_count == 2) {
+      envchain_abort_with_help();
+    }
+    else {
+      args[args_count++] = argv[0];
+    }
     argv++; argc--;
+  }
+  if (args_count != 2) envchain_abort_with_help();
+  keys.dst = args[1];
 
-    envchain_delete_value(name, key);
+  if (mode == ENVCHAIN_RENAME) {
+    if (strcmp(args[0], keys.dst) == 0 || strpbrk(args[0], ",:") != NULL) envchain_abort_with_help();
+    return envchain_rename(args[0], keys.dst, policy);
   }
 
-  return 0;
+  selectors = envchain_selectors_parse((char*)args[0], &selectors_count);
+  if (selectors_count == 0 || (mode == ENVCHAIN_COPY && selectors_count != 1)) envchain_abort_with_help();
+  for (int i = 0; i < selectors_count; i++) {
+    if (strcmp(selectors[i].name, keys.dst) == 0) {
+      fprintf(stderr, "%s: `%s' is both a source and the destination\n", envchain_name, keys.dst);
+      free(selectors);
+      return 2;
+    }
+  }
+
+  /* the keys DST has already; attributes only, and not needed to overwrite */
+  if (policy != ENVCHAIN_CONFLICT_OVERWRITE &&
+      envchain_search_keys(&envchain_copy_keys_callback, &keys) != 0) {
+    free(selectors);
+    return 1;
+  }
+
+  /* one pass over the sources; of those, later ones take precedence */
+  env = envchain_env_new();
+  if (envchain_search_values_multi(selectors, selectors_count, &envchain_copy_collect_callback, env) == 0) {
+    result = envchain_copy_store(env, keys.dst, &keys.dst_keys, policy);
+  }
+
+  envchain_env_free(env);
+  envchain_key_list_free(&keys.dst_keys);
+  free(selectors);
+  return result;
 }
 
 /* functions for exec mode */
 
+/* set by --from-bundle: no agent, and a failed lookup is fatal */
+static int envchain_exec_from_bundle = 0;
+
+static void
+envchain_exec_value_callback(const char* key, const char* value, size_t value_len, void *context)
+{
+  envchain_env_set((envchain_env*)context, key, value, value_len);
+}
+
+static int
+envchain_exec_check_size(char **args, size_t env_bytes)
+{
+  long arg_max = sysconf(_SC_ARG_MAX);
+  size_t bytes = env_bytes + sizeof(char*);
+  char **p;
+
+  for (p = args; *p; p++) bytes += strlen(*p) + 1 + sizeof(char*);
+
+  if (0 < arg_max && (size_t)arg_max < bytes) {
+    fprintf(stderr,
+      "%s: arguments and environment take %zu bytes (environment: %zu bytes), "
+      "exceeding ARG_MAX (%ld bytes)\n",
+      envchain_name, bytes, env_bytes, arg_max);
+    return 1;
+  }
+  return 0;
+}
+
 static void
-envchain_exec_value_callback(const char* key, const char* value, void *context)
+envchain_exec_warn_missing_keys(const envchain_selector *selectors, int selectors_count, envchain_env *env)
+{
+  for (int i = 0; i < selectors_count; i++) {
+    for (int j = 0; selectors[i].keys && j < selectors[i].keys_count; j++) {
+      if (envchain_env_get(env, selectors[i].keys[j]) != NULL) continue;
+      fprintf(stderr, "WARNING: `%s:%s` not defined.\n", selectors[i].name, selectors[i].keys[j]);
+    }
+  }
+}
+
+/* functions for --fd and --fd-threshold */
+
+typedef struct {
+  envchain_env *env;
+  const char **keys; /* comma separated lists given to --fd */
+  int keys_count;
+  long threshold; /* -1 when not given */
+  int failed;
+} envchain_fd_context;
+
+static int
+envchain_fd_key_listed(const envchain_fd_context *context, const char *key)
+{
+  size_t key_len = strlen(key);
+
+  for (int i = 0; i < context->keys_count; i++) {
+    const char *p = context->keys[i];
+    while (*p) {
+      size_t len = strcspn(p, ",");
+      if (len == key_len && strncmp(p, key, len) == 0) return 1;
+      p += len;
+      if (*p == ',') p++;
+    }
+  }
+  return 0;
+}
+
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+static void
+envchain_fd_apply(const char *key, const char *value, size_t len, void *raw_context)
+{
+  envchain_fd_context *context = raw_context;
+  char path[32];
+  int fd;
+
+  /* values containing NULs can't be put into the environment at all */
+  if (!envchain_fd_key_listed(context, key) &&
+      !(0 <= context->threshold && (size_t)context->threshold < len) &&
+      memchr(value, '\0', len) == NULL) {
+    return;
+  }
+
+  /* left open without FD_CLOEXEC, so CMD inherits it */
+  fd = memfd_create(key, MFD_ALLOW_SEALING);
+  if (0 <= fd && fd <= STDERR_FILENO) {
+    int moved = fcntl(fd, F_DUPFD, STDERR_FILENO + 1);
+    close(fd);
+    fd = moved;
+  }
+  if (fd < 0) {
+    fprintf(stderr, "%s: memfd_create failed for %s: %s\n", envchain_name, key, strerror(errno));
+    context->failed = 1;
+    return;
+  }
+
+  for (size_t written = 0; written < len; ) {
+    ssize_t n = write(fd, value + written, len - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "%s: writing %s to memfd failed: %s\n", envchain_name, key, strerror(errno));
+      close(fd);
+      context->failed = 1;
+      return;
+    }
+    written += n;
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+    fprintf(stderr, "%s: sealing memfd of %s failed: %s\n", envchain_name, key, strerror(errno));
+    close(fd);
+    context->failed = 1;
+    return;
+  }
+
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  envchain_env_set(context->env, key, path, strlen(path));
+}
+#endif
+
+/*
+ * Moves the selected values of env, and those containing NULs, into memory
+ * files; non-zero on failure
+ */
+static int
+envchain_fd_move_values(envchain_fd_context *context)
+{
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+  envchain_env_foreach(context->env, &envchain_fd_apply, context);
+  return context->failed;
+#else
+  if (context->keys_count == 0 && context->threshold < 0) return 0;
+  fprintf(stderr, "%s: Sorry, `--fd' is unsupported on this platform\n", envchain_name);
+  return 1;
+#endif
+}
+
+/* Collects the values selected by selectors; NULL on a fatal error */
+static envchain_env*
+envchain_exec_fetch_selectors(const envchain_selector *selectors, int selectors_count)
 {
-  (void)context; /* silence warning */
+  envchain_env *env;
 
-  setenv(key, value, 1);
+  /* values of later namespaces take precedence over earlier ones */
+  env = envchain_env_new();
+  int agent_result = -1;
+  if (!envchain_exec_from_bundle) {
+    uint64_t trace_begin = envchain_trace_begin();
+    agent_result = envchain_agent_search_values(selectors, selectors_count, &envchain_exec_value_callback, env);
+    envchain_trace_end(ENVCHAIN_TRACE_AGENT, trace_begin);
+  }
+  if (agent_result != 0) {
+    int result = envchain_coalesce_search_values(selectors, selectors_count, &envchain_exec_value_callback, env);
+    if (result != 0 && envchain_exec_from_bundle) {
+      envchain_env_free(env);
+      return NULL;
+    }
+  }
+  envchain_exec_warn_missing_keys(selectors, selectors_count, env);
+  return env;
+}
+
+/* Collects the values selected by names (split in place); NULL on a fatal error */
+static envchain_env*
+envchain_exec_fetch(char *names)
+{
+  envchain_selector *selectors;
+  int selectors_count = 0;
+  envchain_env *env;
+
+  selectors = envchain_selectors_parse(names, &selectors_count);
+  if (envchain_selectors_expand(&selectors, &selectors_count) != 0) {
+    free(selectors);
+    return NULL;
+  }
+  env = envchain_exec_fetch_selectors(selectors, selectors_count);
+  free(selectors);
+  return env;
 }
 
 int
 envchain_exec(int argc, const char **argv)
 {
-  if (argc < 2) envchain_abort_with_help();
+  char *names, *exe, *end;
+  char **args = NULL, **envp = NULL;
+  envchain_env *env;
+  size_t env_bytes;
+  envchain_fd_context fd_context = {NULL, NULL, 0, -1, 0};
 
-  char *name, *names, *exe;
-  char **args;
+  fd_context.keys = malloc(sizeof(char*) * (argc + 1));
+  while (0 < argc) {
+    if (strncmp(argv[0], "--fd=", 5) == 0) {
+      fd_context.keys[fd_context.keys_count++] = argv[0] + 5;
+    }
+    else if (strncmp(argv[0], "--fd-threshold=", 15) == 0) {
+      fd_context.threshold = strtol(argv[0] + 15, &end, 10);
+      if (argv[0][15] == '\0' || *end != '\0' || fd_context.threshold < 0) envchain_abort_with_help();
+    }
+    else {
+      break;
+    }
+    argv++; argc--;
+  }
+  if (argc < 2) envchain_abort_with_help();
 
   names = (char*)argv[0];
   exe = (char*)argv[1];
   argv++; argc--;
   argv++; argc--;
 
-  while ((name = strsep(&names, ",")) != NULL) {
-    envchain_search_values(name, &envchain_exec_value_callback, NULL);
+  env = envchain_exec_fetch(names);
+  if (env == NULL) {
+    free(fd_context.keys);
+    return 1;
   }
 
+  uint64_t trace_begin = envchain_trace_begin();
+
+  fd_context.env = env;
+  if (envchain_fd_move_values(&fd_context) != 0) goto fail;
+  free(fd_context.keys);
+  fd_context.keys = NULL;
+
   int len = (2+argc);
   args = malloc(sizeof(char*) * len);
   args[0] = (char*)exe;
   args[len-1] = NULL;
   if (0 < argc) memcpy(args+1, argv, sizeof(char*) * argc);
 
-  if (execvp(exe, args) < 0) {
+  envp = envchain_env_build(env, &env_bytes);
+  if (envchain_exec_check_size(args, env_bytes) != 0) goto fail;
+  envchain_trace_end(ENVCHAIN_TRACE_PREPARE, trace_begin);
+  envchain_trace_flush();
+
+  if (envchain_execvpe(exe, args, envp) < 0) {
     fprintf(stderr, "execvp failed: %s\n", strerror(errno));
+    goto fail;
+  }
+  return 0;
+
+fail:
+  free(fd_context.keys);
+  free(args);
+  free(envp);
+  envchain_env_free(env);
+  return 1;
+}
+
+/* functions for --each */
+
+static int
+envchain_each_wait(int *running)
+{
+  int status;
+  pid_t pid;
+
+  while ((pid = wait(&status)) < 0 && errno == EINTR);
+  if (pid < 0) {
+    /* no child left to wait for; their statuses are lost */
+    *running = 0;
     return 1;
   }
+  (*running)--;
+
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return 1;
+}
+
+int
+envchain_each(int argc, const char **argv)
+{
+  const char *names = NULL;
+  long jobs = 1;
+  int delim = '\n', running = 0, result = 0, status;
+  char *line = NULL, *end;
+  size_t line_cap = 0, env_bytes;
+  ssize_t len;
+  envchain_env *env;
+  char **envp;
+  posix_spawn_file_actions_t actions;
+
+  while (0 < argc) {
+    if (strcmp(argv[0], "-0") == 0 || strcmp(argv[0], "--null") == 0) {
+      delim = '\0';
+    }
+    else if (strcmp(argv[0], "-j") == 0 || strcmp(argv[0], "--jobs") == 0) {
+      if (argc < 2) envchain_abort_with_help();
+      argv++; argc--;
+      jobs = strtol(argv[0], &end, 10);
+      if (*end != '\0' || jobs < 1) envchain_abort_with_help();
+    }
+    else if (strncmp(argv[0], "-j", 2) == 0) {
+      jobs = strtol(argv[0] + 2, &end, 10);
+      if (*end != '\0' || jobs < 1) envchain_abort_with_help();
+    }
+    else {
+      if (names) envchain_abort_with_help();
+      names = argv[0];
+    }
+    argv++; argc--;
+  }
+  if (names == NULL) envchain_abort_with_help();
+
+  env = envchain_exec_fetch((char*)names);
+  if (env == NULL) return 1;
+
+  uint64_t trace_begin = envchain_trace_begin();
+  envp = envchain_env_build(env, &env_bytes);
+  envchain_trace_end(ENVCHAIN_TRACE_PREPARE, trace_begin);
+  envchain_trace_flush();
+
+  /* with SIGCHLD ignored (as inherited), workers would be reaped before their status is read */
+  signal(SIGCHLD, SIG_DFL);
+
+  /* stdin carries the command lines; don't let commands consume it */
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+  while ((len = getdelim(&line, &line_cap, delim, stdin)) >= 0) {
+    char *args[] = {"sh", "-c", line, NULL};
+    pid_t pid;
+    int err;
+
+    if (0 < len && line[len - 1] == delim) line[--len] = '\0';
+    if (len == 0) continue;
+
+    while (jobs <= running) {
+      status = envchain_each_wait(&running);
+      if (result < status) result = status;
+    }
+
+    if (envchain_exec_check_size(args, env_bytes) != 0) {
+      if (result < 126) result = 126;
+      continue;
+    }
+    err = posix_spawn(&pid, "/bin/sh", &actions, NULL, args, envp);
+    if (err != 0) {
+      fprintf(stderr, "%s: unable to run `%s': %s\n", envchain_name, line, strerror(err));
+      if (result < 127) result = 127;
+      continue;
+    }
+    running++;
+  }
+
+  while (0 < running) {
+    status = envchain_each_wait(&running);
+    if (result < status) result = status;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  free(line);
+  free(envp);
+  envchain_env_free(env);
+  return result;
+}
+
+/* functions for --watch */
+
+static volatile pid_t envchain_watch_child = 0;
+static int envchain_watch_wake[2] = {-1, -1};
+
+static const struct {
+  const char *name;
+  int number;
+} envchain_watch_signals[] = {
+  {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"TERM", SIGTERM},
+  {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {NULL, 0}
+};
+
+static int
+envchain_watch_parse_signal(const char *str)
+{
+  char *end;
+  long number = strtol(str, &end, 10);
+
+  if (*str != '\0' && *end == '\0') return (0 < number && number < NSIG) ? (int)number : -1;
+  if (strncmp(str, "SIG", 3) == 0) str += 3;
+  for (int i = 0; envchain_watch_signals[i].name; i++) {
+    if (strcmp(str, envchain_watch_signals[i].name) == 0) return envchain_watch_signals[i].number;
+  }
+  return -1;
+}
+
+/* SIGCHLD wakes up the backend's watch; the others are passed on to CMD */
+static void
+envchain_watch_signal_handler(int sig)
+{
+  int saved_errno = errno;
+
+  if (sig == SIGCHLD) {
+    ssize_t written = write(envchain_watch_wake[1], "", 1);
+    (void)written;
+  }
+  else if (0 < envchain_watch_child) {
+    kill(envchain_watch_child, sig);
+  }
+  errno = saved_errno;
+}
+
+/* Only keys are kept: a key is fetched again from every namespace selecting it */
+static void
+envchain_watch_change_callback(const char *name, const char *key, void *raw_context)
+{
+  (void)name;
+  envchain_key_list_add((envchain_key_list*)raw_context, key);
+}
+
+typedef struct {
+  envchain_env *env;
+  const envchain_key_list *changes;
+} envchain_watch_copy_context;
+
+static void
+envchain_watch_copy_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_watch_copy_context *context = raw_context;
+  if (!envchain_key_list_has(context->changes, key)) envchain_env_set(context->env, key, value, value_len);
+}
+
+/*
+ * Copies env, fetching the changed keys again from every selector that
+ * selects them, so that later namespaces still take precedence; NULL when
+ * the fetch failed
+ */
+static envchain_env*
+envchain_watch_reload(envchain_env *env, const envchain_selector *selectors, int selectors_count,
+                      const envchain_key_list *changes)
+{
+  envchain_selector *refetch = malloc(sizeof(envchain_selector) * selectors_count);
+  const char **keys = malloc(sizeof(char*) * selectors_count * changes->count);
+  envchain_watch_copy_context context = {envchain_env_new(), changes};
+  int refetch_count = 0, result = 0;
+
+  for (int i = 0; i < selectors_count; i++) {
+    envchain_selector *selector = &refetch[refetch_count];
+    selector->name = selectors[i].name;
+    selector->keys = keys + i * changes->count;
+    selector->keys_count = 0;
+    for (int j = 0; j < changes->count; j++) {
+      if (envchain_selector_has_key(&selectors[i], changes->keys[j])) {
+        selector->keys[selector->keys_count++] = changes->keys[j];
+      }
+    }
+    if (0 < selector->keys_count) refetch_count++;
+  }
+
+  envchain_env_foreach(env, &envchain_watch_copy_callback, &context);
+  if (0 < refetch_count) {
+    result = envchain_search_values_multi(refetch, refetch_count, &envchain_exec_value_callback, context.env);
+  }
+  free(keys);
+  free(refetch);
+  if (result != 0) {
+    envchain_env_free(context.env);
+    return NULL;
+  }
+  return context.env;
+}
+
+/* ItemChanged is also sent for changes of labels and other attributes */
+static int
+envchain_watch_differs(envchain_env *a, envchain_env *b, const envchain_key_list *changes)
+{
+  for (int i = 0; i < changes->count; i++) {
+    size_t x_len = 0, y_len = 0;
+    const char *x = envchain_env_get_len(a, changes->keys[i], &x_len);
+    const char *y = envchain_env_get_len(b, changes->keys[i], &y_len);
+    if ((x == NULL) != (y == NULL) || x_len != y_len || (x && memcmp(x, y, x_len) != 0)) return 1;
+  }
   return 0;
 }
 
+/* Returns 0, or the exit status for a CMD that could not be started */
+static int
+envchain_watch_spawn(envchain_env *env, char **args)
+{
+  size_t env_bytes;
+  char **envp = envchain_env_build(env, &env_bytes);
+  pid_t pid;
+
+  if (envchain_exec_check_size(args, env_bytes) != 0) {
+    free(envp);
+    return 126;
+  }
+  if (envchain_spawnvpe(&pid, args[0], args, envp) != 0) {
+    fprintf(stderr, "%s: unable to run `%s': %s\n", envchain_name, args[0], strerror(errno));
+    free(envp);
+    return 127;
+  }
+  envchain_watch_child = pid;
+  free(envp);
+  return 0;
+}
+
+int
+envchain_watch(int argc, const char **argv)
+{
+  const envchain_backend *backend = envchain_backend_get();
+  envchain_selector *selectors;
+  envchain_key_list changes = {NULL, 0, 0};
+  envchain_env *env;
+  int selectors_count = 0, restart_signal = SIGTERM, restarting = 0, status = 0, result;
+  const int forwarded[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM, 0};
+  struct sigaction action;
+  char **args, buf[64];
+  pid_t pid;
+
+  while (0 < argc && strncmp(argv[0], "--signal=", 9) == 0) {
+    restart_signal = envchain_watch_parse_signal(argv[0] + 9);
+    if (restart_signal < 0) {
+      fprintf(stderr, "%s: unknown signal `%s'\n", envchain_name, argv[0] + 9);
+      return 2;
+    }
+    argv++; argc--;
+  }
+  if (argc < 2) envchain_abort_with_help();
+  args = (char**)argv + 1;
+
+  if (backend->watch == NULL) {
+    fprintf(stderr, "%s: Sorry, `--watch' is unsupported with the %s backend\n", envchain_name, backend->name);
+    return 1;
+  }
+
+  if (pipe(envchain_watch_wake) != 0) {
+    fprintf(stderr, "%s: pipe failed: %s\n", envchain_name, strerror(errno));
+    return 1;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(envchain_watch_wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(envchain_watch_wake[i], F_SETFL, O_NONBLOCK);
+  }
+
+  /* start watching (returning right away) before the first fetch, so that no change is missed */
+  selectors = envchain_selectors_parse((char*)argv[0], &selectors_count);
+  if (envchain_selectors_expand(&selectors, &selectors_count) != 0 ||
+      write(envchain_watch_wake[1], "", 1) != 1 ||
+      backend->watch(selectors, selectors_count, envchain_watch_wake[0], &envchain_watch_change_callback, &changes) != 0) {
+    free(selectors);
+    return 1;
+  }
+  envchain_key_list_clear(&changes);
+
+  env = envchain_exec_fetch_selectors(selectors, selectors_count);
+  if (env == NULL) {
+    free(selectors);
+    return 1;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &envchain_watch_signal_handler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGCHLD, &action, NULL);
+  for (int i = 0; forwarded[i]; i++) sigaction(forwarded[i], &action, NULL);
+
+  envchain_trace_flush();
+  result = envchain_watch_spawn(env, args);
+
+  while (result == 0) {
+    while (read(envchain_watch_wake[0], buf, sizeof(buf)) > 0);
+    while ((pid = waitpid(envchain_watch_child, &status, WNOHANG)) < 0 && errno == EINTR);
+    if (pid != 0) {
+      if (pid < 0 || !restarting) break;
+      /* CMD stopped as asked; start it again with the new values */
+      restarting = 0;
+      result = envchain_watch_spawn(env, args);
+      continue;
+    }
+
+    if (backend->watch(selectors, selectors_count, envchain_watch_wake[0], &envchain_watch_change_callback, &changes) != 0) {
+      fprintf(stderr, "%s: watching for changes failed; %s is no longer restarted\n", envchain_name, args[0]);
+      while ((pid = waitpid(envchain_watch_child, &status, 0)) < 0 && errno == EINTR);
+      break;
+    }
+    if (changes.count == 0) continue;
+
+    envchain_env *reloaded = envchain_watch_reload(env, selectors, selectors_count, &changes);
+    if (reloaded == NULL) {
+      fprintf(stderr, "%s: fetching changed values failed; keeping the current ones\n", envchain_name);
+    }
+    else if (!envchain_watch_differs(env, reloaded, &changes)) {
+      envchain_env_free(reloaded);
+    }
+    else {
+      envchain_env_free(env);
+      env = reloaded;
+      fprintf(stderr, "%s: values changed, restarting %s\n", envchain_name, args[0]);
+      if (!restarting) kill(envchain_watch_child, restart_signal);
+      restarting = 1;
+    }
+    envchain_key_list_clear(&changes);
+  }
+
+  envchain_key_list_free(&changes);
+  envchain_env_free(env);
+  free(selectors);
+  if (result != 0) return result;
+  if (pid < 0) return 1;
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return WEXITSTATUS(status);
+}
+
+/* functions for --export */
+
+typedef enum {
+  ENVCHAIN_EXPORT_SH,
+  ENVCHAIN_EXPORT_DOTENV,
+  ENVCHAIN_EXPORT_JSON,
+  ENVCHAIN_EXPORT_NUL
+} envchain_export_format;
+
+static const char *envchain_export_format_names[] = {"sh", "dotenv", "json", "nul", NULL};
+
+typedef struct {
+  envchain_export_format format;
+  int count;
+} envchain_export_context;
+
+static int
+envchain_export_is_name(const char *key)
+{
+  if (!(*key == '_' || isalpha((unsigned char)*key))) return 0;
+  for (key++; *key; key++) {
+    if (!(*key == '_' || isalnum((unsigned char)*key))) return 0;
+  }
+  return 1;
+}
+
+static void
+envchain_export_value_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_export_context *context = raw_context;
+  const char *format_name = envchain_export_format_names[context->format];
+
+  if (context->format == ENVCHAIN_EXPORT_JSON) {
+    /* JSON strings hold text; other bytes could not be read back as they were */
+    if (!envchain_is_utf8(value, value_len)) {
+      fprintf(stderr, "WARNING: `%s` is not valid UTF-8 and can't be exported as json; skipped.\n", key);
+      return;
+    }
+    putchar(context->count++ ? ',' : '{');
+    envchain_print_json_string(key, strlen(key));
+    putchar(':');
+    envchain_print_json_string(value, value_len);
+    return;
+  }
+
+  if (memchr(value, '\0', value_len) != NULL) {
+    fprintf(stderr, "WARNING: `%s` contains NUL bytes and can't be exported as %s; use --format=json.\n",
+            key, format_name);
+    return;
+  }
+  if (context->format != ENVCHAIN_EXPORT_NUL && !envchain_export_is_name(key)) {
+    fprintf(stderr, "WARNING: `%s` is not a valid variable name for %s; skipped.\n", key, format_name);
+    return;
+  }
+  context->count++;
+
+  switch (context->format) {
+    case ENVCHAIN_EXPORT_SH:
+      /* single quotes keep everything literal; a quote itself is '\'' */
+      printf("export %s='", key);
+      for (size_t i = 0; i < value_len; i++) {
+        if (value[i] == '\'') fputs("'\\''", stdout);
+        else putchar(value[i]);
+      }
+      printf("'\n");
+      break;
+
+    case ENVCHAIN_EXPORT_DOTENV:
+      /* in the forms envchain --set --import reads back */
+      if (memchr(value, '\'', value_len) == NULL && memchr(value, '\n', value_len) == NULL &&
+          memchr(value, '\r', value_len) == NULL) {
+        printf("%s='", key);
+        fwrite(value, 1, value_len, stdout);
+        printf("'\n");
+        break;
+      }
+      printf("%s=\"", key);
+      for (size_t i = 0; i < value_len; i++) {
+        switch (value[i]) {
+          case '\n': fputs("\\n", stdout); break;
+          case '\r': fputs("\\r", stdout); break;
+          case '\t': fputs("\\t", stdout); break;
+          case '"': case '\\': case '$': case '`':
+            putchar('\\');
+            putchar(value[i]);
+            break;
+          default: putchar(value[i]);
+        }
+      }
+      printf("\"\n");
+      break;
+
+    case ENVCHAIN_EXPORT_NUL:
+      printf("%s=", key);
+      fwrite(value, 1, value_len, stdout);
+      putchar('\0');
+      break;
+
+    default:
+      break;
+  }
+}
+
+int
+envchain_export(int argc, const char **argv)
+{
+  envchain_export_context context = {ENVCHAIN_EXPORT_SH, 0};
+  envchain_selector *selectors;
+  int selectors_count = 0, result = 0;
+  char *names = NULL;
+
+  while (0 < argc) {
+    if (strncmp(argv[0], "--format=", 9) == 0) {
+      int i;
+      for (i = 0; envchain_export_format_names[i]; i++) {
+        if (strcmp(argv[0] + 9, envchain_export_format_names[i]) == 0) break;
+      }
+      if (envchain_export_format_names[i] == NULL) {
+        fprintf(stderr, "%s: unknown format `%s'; available: sh dotenv json nul\n", envchain_name, argv[0] + 9);
+        return 2;
+      }
+      context.format = (envchain_export_format)i;
+    }
+    else if (argv[0][0] == '-' || names != NULL) {
+      envchain_abort_with_help();
+    }
+    else {
+      names = (char*)argv[0];
+    }
+    argv++; argc--;
+  }
+  if (names == NULL) envchain_abort_with_help();
+
+  /* values are written as they arrive; later namespaces are written last and win */
+  selectors = envchain_selectors_parse(names, &selectors_count);
+  if (envchain_selectors_expand(&selectors, &selectors_count) != 0) {
+    free(selectors);
+    return 1;
+  }
+  uint64_t trace_begin = envchain_trace_begin();
+  int agent_result = envchain_agent_search_values(selectors, selectors_count, &envchain_export_value_callback, &context);
+  envchain_trace_end(ENVCHAIN_TRACE_AGENT, trace_begin);
+  if (agent_result != 0) {
+    result = envchain_coalesce_search_values(selectors, selectors_count, &envchain_export_value_callback, &context);
+  }
+  free(selectors);
+
+  if (context.format == ENVCHAIN_EXPORT_JSON) {
+    if (context.count == 0) putchar('{');
+    printf("}\n");
+  }
+  if (fflush(stdout) != 0) {
+    fprintf(stderr, "%s: writing output failed: %s\n", envchain_name, strerror(errno));
+    return 1;
+  }
+  return result != 0;
+}
+
+/* functions for --seal and --from-bundle */
+
+/* Consumes a leading --key-file FILE; falls back to ENVCHAIN_BUNDLE_KEY_FILE */
+static const char*
+envchain_bundle_key_file(int *argc, const char ***argv)
+{
+  const char *key_file = getenv("ENVCHAIN_BUNDLE_KEY_FILE");
+
+  if (0 < *argc && strcmp((*argv)[0], "--key-file") == 0) {
+    if (*argc < 2) envchain_abort_with_help();
+    key_file = (*argv)[1];
+    *argv += 2; *argc -= 2;
+  }
+  if (key_file == NULL || key_file[0] == '\0') {
+    fprintf(stderr, "%s: a bundle key is required; give --key-file or set ENVCHAIN_BUNDLE_KEY_FILE\n",
+            envchain_name);
+    exit(2);
+  }
+  return key_file;
+}
+
+int
+envchain_seal(int argc, const char **argv)
+{
+  const char *key_file = envchain_bundle_key_file(&argc, &argv);
+  envchain_selector *selectors;
+  int selectors_count, result;
+
+  if (argc != 1) envchain_abort_with_help();
+  if (isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "%s: refusing to write a bundle to a terminal; redirect stdout to a file\n",
+            envchain_name);
+    return 2;
+  }
+
+  selectors = envchain_selectors_parse((char*)argv[0], &selectors_count);
+  if (envchain_selectors_expand(&selectors, &selectors_count) != 0) {
+    free(selectors);
+    return 1;
+  }
+  result = envchain_vault_seal(stdout, key_file, selectors, selectors_count);
+  free(selectors);
+  return result;
+}
+
+int
+envchain_from_bundle(int argc, const char **argv)
+{
+  const char *bundle, *key_file;
+
+  if (argc < 1) envchain_abort_with_help();
+  bundle = argv[0];
+  argv++; argc--;
+  key_file = envchain_bundle_key_file(&argc, &argv);
+
+  /* values come from the bundle only, never from the keychain or an agent */
+  envchain_vault_use(bundle, key_file);
+  envchain_backend_set(&envchain_backend_vault);
+  envchain_exec_from_bundle = 1;
+  return envchain_exec(argc, argv);
+}
+
 /* entry point */
 
 int
 main(int argc, const char **argv)
 {
+  const char *trace = NULL;
+
   envchain_name = argv[0];
   if (argc < 2) envchain_abort_with_help();
   argv++; argc--;
 
+  if (strcmp(argv[0], "--trace") == 0 || strncmp(argv[0], "--trace=", 8) == 0) {
+    trace = argv[0][7] == '=' ? argv[0] + 8 : "1";
+    argv++; argc--;
+    if (argc < 1) envchain_abort_with_help();
+  }
+
   if (strcmp(argv[0], "--set") == 0 || strcmp(argv[0], "-s") == 0) {
     argv++; argc--;
+    envchain_trace_init(trace, "set");
     return envchain_set(argc, argv);
   }
   else if (strcmp(argv[0], "--list") == 0 || strcmp(argv[0], "-l") == 0) {
     argv++; argc--;
+    envchain_trace_init(trace, "list");
     return envchain_list(argc, argv);
   }
   else if (strcmp(argv[0], "--unset") == 0) {
     argv++; argc--;
+    envchain_trace_init(trace, "unset");
     return envchain_unset(argc, argv);
   }
+  else if (strcmp(argv[0], "--copy") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "copy");
+    return envchain_copy(argc, argv, ENVCHAIN_COPY);
+  }
+  else if (strcmp(argv[0], "--merge") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "merge");
+    return envchain_copy(argc, argv, ENVCHAIN_MERGE);
+  }
+  else if (strcmp(argv[0], "--rename") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "rename");
+    return envchain_copy(argc, argv, ENVCHAIN_RENAME);
+  }
+  else if (strcmp(argv[0], "--each") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "each");
+    return envchain_each(argc, argv);
+  }
+  else if (strcmp(argv[0], "--watch") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "watch");
+    return envchain_watch(argc, argv);
+  }
+  else if (strcmp(argv[0], "--export") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "export");
+    return envchain_export(argc, argv);
+  }
+  else if (strcmp(argv[0], "--seal") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "seal");
+    return envchain_seal(argc, argv);
+  }
+  else if (strcmp(argv[0], "--from-bundle") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "exec");
+    return envchain_from_bundle(argc, argv);
+  }
+  else if (strcmp(argv[0], "--agent") == 0) {
+    argv++; argc--;
+    envchain_trace_init(trace, "agent");
+    return envchain_agent(argc, argv);
+  }
+  else if (strncmp(argv[0], "--fd=", 5) == 0 || strncmp(argv[0], "--fd-threshold=", 15) == 0) {
+    envchain_trace_init(trace, "exec");
+    return envchain_exec(argc, argv);
+  }
   else if (argv[0][0] == '-') {
     fprintf(stderr, "Unknown option %s\n", argv[0]);
     return 2;
   }
   else {
+    envchain_trace_init(trace, "exec");
     return envchain_exec(argc, argv);
   }
 }
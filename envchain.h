@@ -1,24 +1,234 @@
 #ifndef ENVCHAIN_H
 #define ENVCHAIN_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
 extern const char *envchain_name;
 
+/* value holds value_len bytes and may contain NULs; it is not NUL-terminated */
 typedef void (*envchain_search_callback)(const char *key, const char *value,
-                                         void *context);
+                                         size_t value_len, void *context);
 typedef void (*envchain_namespace_search_callback)(const char *name,
                                                    void *context);
+typedef void (*envchain_key_search_callback)(const char *name, const char *key,
+                                             void *context);
+/* Returns non-zero to select the item */
+typedef int (*envchain_key_match_callback)(const char *name, const char *key,
+                                           void *context);
+/* An item was created, changed or deleted */
+typedef void (*envchain_watch_callback)(const char *name, const char *key,
+                                        void *context);
 
 typedef struct {
   const char *target;
   int show_value;
 } envchain_list_context;
 
+/* NAMESPACE, or NAMESPACE:KEY1,KEY2 to select only some of its keys */
+typedef struct {
+  const char *name;
+  const char **keys; /* NULL selects every key */
+  int keys_count;
+} envchain_selector;
+
+/*
+ * Operations every backend provides. The one in use is chosen at runtime by
+ * ENVCHAIN_BACKEND, defaulting to the platform keychain.
+ */
+typedef struct {
+  const char *name;
+  int (*search_namespaces)(envchain_namespace_search_callback callback,
+                           void *data);
+  /* Every item's namespace and key, in no particular order; no secrets */
+  int (*search_keys)(envchain_key_search_callback callback, void *data);
+  int (*search_values_multi)(const envchain_selector *selectors,
+                             int selectors_count,
+                             envchain_search_callback callback, void *data);
+  /* Returns the number of keys that failed */
+  int (*save_values)(const char *name, const char **keys, const char **values,
+                     const size_t *value_lens, int count,
+                     int require_passphrase);
+  /*
+   * Deletes the items of namespace name (of every namespace when NULL) that
+   * match selects; returns the number of items that failed, or -1 when the
+   * items could not be searched.
+   */
+  int (*delete_values)(const char *name, envchain_key_match_callback match,
+                       void *data);
+  /*
+   * Optional. Moves the items of namespace name that match selects to
+   * new_name by changing their attributes only; returns as delete_values.
+   */
+  int (*rename_values)(const char *name, const char *new_name,
+                       envchain_key_match_callback match, void *data);
+  /*
+   * Optional. Blocks until items matching selectors have changed, passing
+   * each of them to callback, or until wake_fd is readable. Watching starts
+   * with the first call; changes made between calls are reported by the next
+   * one. Returns non-zero on failure.
+   */
+  int (*watch)(const envchain_selector *selectors, int selectors_count,
+               int wake_fd, envchain_watch_callback callback, void *data);
+} envchain_backend;
+
+extern const envchain_backend envchain_backend_keychain;       /* macOS */
+extern const envchain_backend envchain_backend_secret_service; /* Linux */
+extern const envchain_backend envchain_backend_vault;
+
+/* envchain_backend.c; these dispatch to the selected backend */
+const envchain_backend *envchain_backend_get(void);
+/* Overrides ENVCHAIN_BACKEND */
+void envchain_backend_set(const envchain_backend *backend);
+
 int envchain_search_namespaces(envchain_namespace_search_callback callback,
                                void *data);
+int envchain_search_keys(envchain_key_search_callback callback, void *data);
 int envchain_search_values(const char *name, envchain_search_callback callback,
                            void *data);
+/* Values of later selectors are passed to the callback after earlier ones. */
+int envchain_search_values_multi(const envchain_selector *selectors,
+                                 int selectors_count,
+                                 envchain_search_callback callback,
+                                 void *data);
 void envchain_save_value(const char *name, const char *key, char *value,
                          int require_passphrase);
+/*
+ * Stores all values at once; returns the number of keys that failed.
+ * value_lens may be NULL for NUL-terminated values.
+ */
+int envchain_save_values(const char *name, const char **keys,
+                         const char **values, const size_t *value_lens,
+                         int count, int require_passphrase);
 void envchain_delete_value(const char *name, const char *key);
+int envchain_delete_values(const char *name, envchain_key_match_callback match,
+                           void *data);
+
+/* envchain_arena.c */
+/* Locked memory for secret material, zeroed by envchain_arena_wipe() or at exit */
+void *envchain_arena_alloc(size_t size);
+/* As envchain_arena_alloc, but not wiped in forked children */
+void *envchain_arena_alloc_inherited(size_t size);
+void envchain_arena_wipe(void);
+
+/* envchain_selector.c */
+/* Splits spec in place; the result is a single block to free() */
+envchain_selector *envchain_selectors_parse(char *spec, int *count);
+int envchain_selector_has_key(const envchain_selector *selector,
+                              const char *key);
+/* Whether pattern has fnmatch(3) wildcards */
+int envchain_is_glob(const char *pattern);
+/*
+ * Replaces glob selectors with the namespaces they match, found with one
+ * enumeration; *selectors is freed and replaced. Non-zero if that fails.
+ */
+int envchain_selectors_expand(envchain_selector **selectors, int *count);
+
+/* envchain_crypto.c */
+#define ENVCHAIN_AEAD_KEY_SIZE 32
+#define ENVCHAIN_AEAD_NONCE_SIZE 12
+#define ENVCHAIN_AEAD_TAG_SIZE 16
+
+/* ChaCha20-Poly1305 (RFC 8439); cipher may alias plain */
+void envchain_aead_seal(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                        const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                        const unsigned char *aad, size_t aad_len,
+                        const unsigned char *plain, size_t len,
+                        unsigned char *cipher,
+                        unsigned char tag[ENVCHAIN_AEAD_TAG_SIZE]);
+/* Returns -1, leaving plain untouched, when the tag does not match */
+int envchain_aead_open(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                       const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                       const unsigned char *aad, size_t aad_len,
+                       const unsigned char *cipher, size_t len,
+                       const unsigned char tag[ENVCHAIN_AEAD_TAG_SIZE],
+                       unsigned char *plain);
+int envchain_random_bytes(unsigned char *buf, size_t len);
+
+/* envchain_vault.c */
+/* Makes the vault backend read path with the key at key_path */
+void envchain_vault_use(const char *path, const char *key_path);
+/* Fetches the values of expanded selectors and writes them to out in the vault format */
+int envchain_vault_seal(FILE *out, const char *key_path,
+                        const envchain_selector *selectors,
+                        int selectors_count);
+
+/* envchain_import.c */
+int envchain_import(const char *name, FILE *input, int require_passphrase);
+
+/* envchain_env.c */
+typedef struct envchain_env envchain_env;
+
+envchain_env *envchain_env_new(void);
+/* Replaces the value when key is already set */
+void envchain_env_set(envchain_env *env, const char *key, const char *value,
+                      size_t value_len);
+const char *envchain_env_get(envchain_env *env, const char *key);
+/* As envchain_env_get, also giving the length of values that may hold NULs */
+const char *envchain_env_get_len(envchain_env *env, const char *key,
+                                 size_t *value_len);
+/* In insertion order; callback may replace the value it is given */
+void envchain_env_foreach(envchain_env *env, envchain_search_callback callback,
+                          void *data);
+/*
+ * Builds envp from environ and env, leaving out values containing NULs;
+ * bytes receives the size execve needs
+ */
+char **envchain_env_build(envchain_env *env, size_t *bytes);
+void envchain_env_free(envchain_env *env);
+int envchain_execvpe(const char *file, char **argv, char **envp);
+/* Starts file without waiting; returns -1 with errno set when it fails */
+int envchain_spawnvpe(pid_t *pid, const char *file, char **argv, char **envp);
+
+/* envchain_trace.c */
+typedef enum {
+  ENVCHAIN_TRACE_CONNECT,
+  ENVCHAIN_TRACE_UNLOCK,
+  ENVCHAIN_TRACE_SEARCH,
+  ENVCHAIN_TRACE_LOAD,
+  ENVCHAIN_TRACE_STORE,
+  ENVCHAIN_TRACE_DELETE,
+  ENVCHAIN_TRACE_AGENT,
+  ENVCHAIN_TRACE_COALESCE,
+  ENVCHAIN_TRACE_PREPARE,
+  ENVCHAIN_TRACE_PHASES
+} envchain_trace_phase;
+
+typedef enum {
+  ENVCHAIN_TRACE_DBUS_CALLS,
+  ENVCHAIN_TRACE_RETRIES,
+  ENVCHAIN_TRACE_ITEMS,
+  ENVCHAIN_TRACE_BYTES,
+  ENVCHAIN_TRACE_COUNTERS
+} envchain_trace_counter;
+
+extern int envchain_trace_enabled;
+
+/* dest: "1" or "stderr", a file path, or NULL to read ENVCHAIN_TRACE */
+void envchain_trace_init(const char *dest, const char *mode);
+uint64_t envchain_trace_begin(void);
+void envchain_trace_end(envchain_trace_phase phase, uint64_t begin);
+void envchain_trace_count(envchain_trace_counter counter, uint64_t n);
+void envchain_trace_flush(void);
+/* Nanoseconds of a monotonic clock, whether or not tracing is enabled */
+uint64_t envchain_monotonic_ns(void);
+
+/* envchain_agent.c */
+int envchain_agent(int argc, const char **argv);
+/* Returns non-zero when no agent is available or it could not answer. */
+int envchain_agent_search_values(const envchain_selector *selectors,
+                                 int selectors_count,
+                                 envchain_search_callback callback,
+                                 void *data);
+/*
+ * envchain_search_values_multi, sharing one fetch with concurrent invocations
+ * for the same selectors when ENVCHAIN_COALESCE is set.
+ */
+int envchain_coalesce_search_values(const envchain_selector *selectors,
+                                    int selectors_count,
+                                    envchain_search_callback callback,
+                                    void *data);
 
 #endif
@@ -0,0 +1,996 @@
+/*
+ * envchain --agent keeps namespaces fetched from the backend in memory for a
+ * limited time and hands them out to envchain processes of the same user
+ * over a Unix domain socket, so exec mode does not have to reach the
+ * keychain on every invocation.
+ *
+ * Protocol (host byte order, single request per connection):
+ *   request:  u32 selectors_count, then selectors_count x
+ *             (u32 name_len, name, u32 keys_count, keys_count x (u32 len, key));
+ *             keys_count 0 selects every key of the namespace
+ *   response: u32 status (0 = ok), u32 entries_count,
+ *             then entries_count x (u32 key_len, key, u32 value_len, value)
+ *
+ * With ENVCHAIN_COALESCE=1 and no agent, concurrent exec mode invocations for
+ * the same selectors share one fetch the same way: the first one takes a
+ * per-user lock, fetches, and leaves a short-lived process behind that answers
+ * the others over a socket for ENVCHAIN_COALESCE_LINGER_MS.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "envchain.h"
+
+#define ENVCHAIN_AGENT_DEFAULT_TTL 300
+#define ENVCHAIN_AGENT_CLIENT_TIMEOUT_SEC 1
+#define ENVCHAIN_AGENT_MAX_NAMES 1024
+#define ENVCHAIN_AGENT_MAX_KEYS 4096
+#define ENVCHAIN_AGENT_MAX_ENTRIES (1024 * 1024)
+#define ENVCHAIN_AGENT_MAX_FIELD (16 * 1024 * 1024)
+#define ENVCHAIN_COALESCE_DEFAULT_LINGER_MS 100
+#define ENVCHAIN_COALESCE_MAX_LINGER_MS 60000
+#define ENVCHAIN_COALESCE_WAIT_MS 2000
+
+typedef struct envchain_agent_value {
+  char *key;
+  char *value;
+  size_t value_len;
+  struct envchain_agent_value *next;
+} envchain_agent_value;
+
+typedef struct envchain_agent_namespace {
+  char *name;
+  time_t expires_at;
+  envchain_agent_value *values;
+  envchain_agent_value *tail;
+  struct envchain_agent_namespace *next;
+} envchain_agent_namespace;
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  int secret; /* grown in the arena, and kept by the coalescing server */
+} envchain_agent_buffer;
+
+static envchain_agent_namespace *envchain_agent_cache = NULL;
+static volatile sig_atomic_t envchain_agent_terminated = 0;
+
+/* I/O helpers */
+
+static int
+envchain_agent_write_full(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (0 < len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n; len -= n;
+  }
+  return 0;
+}
+
+static int
+envchain_agent_read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  while (0 < len) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) return -1;
+    p += n; len -= n;
+  }
+  return 0;
+}
+
+/* Reads a length-prefixed field; len (if given) receives its length, as it may contain NULs */
+static int
+envchain_agent_read_field(int fd, char **out, uint32_t *out_len)
+{
+  uint32_t len;
+  char *str;
+
+  if (envchain_agent_read_full(fd, &len, sizeof(len)) < 0) return -1;
+  if (ENVCHAIN_AGENT_MAX_FIELD < len) return -1;
+
+  str = malloc(len + 1);
+  if (str == NULL) return -1;
+  if (envchain_agent_read_full(fd, str, len) < 0) {
+    free(str);
+    return -1;
+  }
+  str[len] = '\0';
+
+  *out = str;
+  if (out_len) *out_len = len;
+  return 0;
+}
+
+static void
+envchain_agent_buffer_append(envchain_agent_buffer *buffer, const void *data, size_t len)
+{
+  if (buffer->cap < buffer->len + len) {
+    size_t cap = buffer->cap ? buffer->cap : 4096;
+    while (cap < buffer->len + len) cap *= 2;
+
+    char *buf = buffer->secret ? envchain_arena_alloc_inherited(cap) : malloc(cap);
+    if (buf == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+    if (buffer->buf) {
+      memcpy(buf, buffer->buf, buffer->len);
+      memset(buffer->buf, 0, buffer->cap);
+      if (!buffer->secret) free(buffer->buf);
+    }
+    buffer->buf = buf;
+    buffer->cap = cap;
+  }
+  memcpy(buffer->buf + buffer->len, data, len);
+  buffer->len += len;
+}
+
+static void
+envchain_agent_buffer_append_bytes(envchain_agent_buffer *buffer, const char *data, size_t data_len)
+{
+  uint32_t len = data_len;
+  envchain_agent_buffer_append(buffer, &len, sizeof(len));
+  envchain_agent_buffer_append(buffer, data, len);
+}
+
+static void
+envchain_agent_buffer_append_field(envchain_agent_buffer *buffer, const char *str)
+{
+  envchain_agent_buffer_append_bytes(buffer, str, strlen(str));
+}
+
+static void
+envchain_agent_buffer_append_selectors(envchain_agent_buffer *buffer,
+                                       const envchain_selector *selectors, int selectors_count)
+{
+  uint32_t count = selectors_count, keys_count, i;
+  int j;
+
+  envchain_agent_buffer_append(buffer, &count, sizeof(count));
+  for (i = 0; i < count; i++) {
+    envchain_agent_buffer_append_field(buffer, selectors[i].name);
+    keys_count = selectors[i].keys ? selectors[i].keys_count : 0;
+    envchain_agent_buffer_append(buffer, &keys_count, sizeof(keys_count));
+    for (j = 0; j < (int)keys_count; j++) {
+      envchain_agent_buffer_append_field(buffer, selectors[i].keys[j]);
+    }
+  }
+}
+
+static void
+envchain_agent_buffer_free(envchain_agent_buffer *buffer)
+{
+  if (buffer->buf) {
+    memset(buffer->buf, 0, buffer->cap);
+    if (!buffer->secret) free(buffer->buf);
+  }
+  buffer->buf = NULL;
+  buffer->len = buffer->cap = 0;
+}
+
+static int
+envchain_agent_peer_is_self(int fd)
+{
+#ifdef __linux__
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return 0;
+  return cred.uid == getuid();
+#else
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(fd, &uid, &gid) < 0) return 0;
+  return uid == getuid();
+#endif
+}
+
+/* socket path */
+
+static char*
+envchain_agent_default_socket_path(void)
+{
+  char *path = NULL;
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+
+  if (runtime_dir != NULL && runtime_dir[0] != '\0') {
+    asprintf(&path, "%s/envchain-agent.sock", runtime_dir);
+  }
+  else {
+    char dir[] = "/tmp/envchain-XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+      fprintf(stderr, "%s: mkdtemp failed: %s\n", envchain_name, strerror(errno));
+      return NULL;
+    }
+    asprintf(&path, "%s/agent.%d", dir, (int)getpid());
+  }
+
+  return path;
+}
+
+static int
+envchain_agent_connect(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (sizeof(addr.sun_path) <= strlen(path)) return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+
+  return fd;
+}
+
+/* cache */
+
+static void
+envchain_agent_namespace_free(envchain_agent_namespace *ns)
+{
+  envchain_agent_value *value = ns->values, *next;
+  while (value) {
+    next = value->next;
+    memset(value->key, 0, strlen(value->key));
+    memset(value->value, 0, value->value_len);
+    free(value->key);
+    free(value->value);
+    free(value);
+    value = next;
+  }
+  free(ns->name);
+  free(ns);
+}
+
+static void
+envchain_agent_cache_expire(time_t now)
+{
+  envchain_agent_namespace **p = &envchain_agent_cache;
+  while (*p) {
+    envchain_agent_namespace *ns = *p;
+    if (ns->expires_at <= now) {
+      *p = ns->next;
+      envchain_agent_namespace_free(ns);
+    }
+    else {
+      p = &ns->next;
+    }
+  }
+}
+
+static void
+envchain_agent_cache_value_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_agent_namespace *ns = raw_context;
+  envchain_agent_value *entry = malloc(sizeof(envchain_agent_value));
+  if (entry == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+
+  entry->key = strdup(key);
+  entry->value = malloc(value_len + 1);
+  if (entry->value == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  memcpy(entry->value, value, value_len);
+  entry->value[value_len] = '\0';
+  entry->value_len = value_len;
+  entry->next = NULL;
+
+  if (ns->tail) ns->tail->next = entry;
+  else ns->values = entry;
+  ns->tail = entry;
+}
+
+static envchain_agent_namespace*
+envchain_agent_cache_fetch(const char *name, int ttl)
+{
+  envchain_agent_namespace *ns;
+
+  for (ns = envchain_agent_cache; ns; ns = ns->next) {
+    if (strcmp(ns->name, name) == 0) return ns;
+  }
+
+  ns = calloc(1, sizeof(envchain_agent_namespace));
+  if (ns == NULL) return NULL;
+  ns->name = strdup(name);
+
+  if (envchain_search_values(name, &envchain_agent_cache_value_callback, ns) != 0) {
+    envchain_agent_namespace_free(ns);
+    return NULL;
+  }
+
+  ns->expires_at = time(NULL) + ttl;
+  ns->next = envchain_agent_cache;
+  envchain_agent_cache = ns;
+  return ns;
+}
+
+static void
+envchain_agent_cache_clear(void)
+{
+  while (envchain_agent_cache) {
+    envchain_agent_namespace *ns = envchain_agent_cache;
+    envchain_agent_cache = ns->next;
+    envchain_agent_namespace_free(ns);
+  }
+}
+
+static time_t
+envchain_agent_cache_next_expiry(void)
+{
+  time_t next = 0;
+  envchain_agent_namespace *ns;
+  for (ns = envchain_agent_cache; ns; ns = ns->next) {
+    if (next == 0 || ns->expires_at < next) next = ns->expires_at;
+  }
+  return next;
+}
+
+/* server */
+
+static void
+envchain_agent_selectors_free(envchain_selector *selectors, uint32_t count)
+{
+  uint32_t i;
+  int j;
+
+  for (i = 0; i < count; i++) {
+    free((char*)selectors[i].name);
+    for (j = 0; selectors[i].keys && j < selectors[i].keys_count; j++) {
+      free((char*)selectors[i].keys[j]);
+    }
+    free(selectors[i].keys);
+  }
+  free(selectors);
+}
+
+static int
+envchain_agent_read_selector(int fd, envchain_selector *selector)
+{
+  uint32_t keys_count;
+  char *field;
+
+  if (envchain_agent_read_field(fd, &field, NULL) < 0) return -1;
+  selector->name = field;
+
+  if (envchain_agent_read_full(fd, &keys_count, sizeof(keys_count)) < 0) return -1;
+  if (ENVCHAIN_AGENT_MAX_KEYS < keys_count) return -1;
+  if (keys_count == 0) return 0;
+
+  selector->keys = calloc(keys_count, sizeof(char*));
+  if (selector->keys == NULL) return -1;
+  for (; (uint32_t)selector->keys_count < keys_count; selector->keys_count++) {
+    if (envchain_agent_read_field(fd, &field, NULL) < 0) return -1;
+    selector->keys[selector->keys_count] = field;
+  }
+  return 0;
+}
+
+static void
+envchain_agent_handle(int fd, int ttl)
+{
+  envchain_agent_buffer response = {NULL, 0, 0, 0};
+  uint32_t selectors_count, status = 0, entries_count = 0;
+  envchain_selector *selectors = NULL;
+  uint32_t i, read_count = 0;
+  struct timeval timeout = {ENVCHAIN_AGENT_CLIENT_TIMEOUT_SEC, 0};
+
+  if (!envchain_agent_peer_is_self(fd)) return;
+  /* a client that stops sending or reading must not stall everyone else */
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  if (envchain_agent_read_full(fd, &selectors_count, sizeof(selectors_count)) < 0) return;
+  if (ENVCHAIN_AGENT_MAX_NAMES < selectors_count) return;
+
+  selectors = calloc(selectors_count, sizeof(envchain_selector));
+  if (selectors == NULL && 0 < selectors_count) return;
+  while (read_count < selectors_count) {
+    /* counted before reading, so a partially read selector is freed too */
+    if (envchain_agent_read_selector(fd, &selectors[read_count++]) < 0) goto ensure;
+  }
+
+  /* reserve the header; filled in after entries are serialized */
+  envchain_agent_buffer_append(&response, &status, sizeof(status));
+  envchain_agent_buffer_append(&response, &entries_count, sizeof(entries_count));
+
+  envchain_agent_cache_expire(time(NULL));
+  for (i = 0; i < selectors_count; i++) {
+    envchain_agent_namespace *ns = envchain_agent_cache_fetch(selectors[i].name, ttl);
+    envchain_agent_value *value;
+    if (ns == NULL) {
+      status = 1;
+      continue;
+    }
+    for (value = ns->values; value; value = value->next) {
+      if (!envchain_selector_has_key(&selectors[i], value->key)) continue;
+      envchain_agent_buffer_append_field(&response, value->key);
+      envchain_agent_buffer_append_bytes(&response, value->value, value->value_len);
+      entries_count++;
+    }
+  }
+
+  memcpy(response.buf, &status, sizeof(status));
+  memcpy(response.buf + sizeof(status), &entries_count, sizeof(entries_count));
+  envchain_agent_write_full(fd, response.buf, response.len);
+
+ensure:
+  envchain_agent_selectors_free(selectors, read_count);
+  envchain_agent_buffer_free(&response);
+}
+
+static void
+envchain_agent_terminate(int signum)
+{
+  (void)signum; /* silence warning */
+  envchain_agent_terminated = 1;
+}
+
+static int
+envchain_agent_listen(const char *path)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t old_umask;
+  int fd, probe;
+
+  if (sizeof(addr.sun_path) <= strlen(path)) {
+    fprintf(stderr, "%s: socket path too long: %s\n", envchain_name, path);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    fprintf(stderr, "%s: socket failed: %s\n", envchain_name, strerror(errno));
+    return -1;
+  }
+
+  /* a socket nobody listens on was left by an agent that died; a live agent is left alone */
+  probe = envchain_agent_connect(path);
+  if (0 <= probe) {
+    fprintf(stderr, "%s: an agent is already listening on %s\n", envchain_name, path);
+    close(probe);
+    close(fd);
+    return -1;
+  }
+  if (errno == ECONNREFUSED && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+  old_umask = umask(0177);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    umask(old_umask);
+    fprintf(stderr, "%s: bind %s failed: %s\n", envchain_name, path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  umask(old_umask);
+
+  if (listen(fd, 64) < 0) {
+    fprintf(stderr, "%s: listen failed: %s\n", envchain_name, strerror(errno));
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+
+  return fd;
+}
+
+int
+envchain_agent(int argc, const char **argv)
+{
+  long ttl = ENVCHAIN_AGENT_DEFAULT_TTL;
+  int foreground = 0;
+  char *end;
+  char *path = NULL;
+  int listen_fd;
+  struct sigaction sa;
+
+  while (0 < argc) {
+    if ((strcmp(argv[0], "--ttl") == 0 || strcmp(argv[0], "-t") == 0) && 1 < argc) {
+      ttl = strtol(argv[1], &end, 10);
+      if (argv[1][0] == '\0' || *end != '\0') ttl = 0;
+      argv += 2; argc -= 2;
+    }
+    else if (strcmp(argv[0], "--socket") == 0 && 1 < argc) {
+      path = strdup(argv[1]);
+      argv += 2; argc -= 2;
+    }
+    else if (strcmp(argv[0], "--foreground") == 0 || strcmp(argv[0], "-f") == 0) {
+      foreground = 1;
+      argv++; argc--;
+    }
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[0]);
+      return 2;
+    }
+  }
+  if (ttl <= 0 || INT_MAX < ttl) {
+    fprintf(stderr, "%s: --ttl must be a positive number of seconds\n", envchain_name);
+    return 2;
+  }
+
+  if (path == NULL) path = envchain_agent_default_socket_path();
+  if (path == NULL) return 1;
+
+  /* Keep cached secrets out of swap and away from debuggers and core dumps */
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+    fprintf(stderr, "%s: warning: mlockall failed: %s\n", envchain_name, strerror(errno));
+  }
+#ifdef __linux__
+  prctl(PR_SET_DUMPABLE, 0);
+#endif
+
+  listen_fd = envchain_agent_listen(path);
+  if (listen_fd < 0) return 1;
+
+  printf("ENVCHAIN_AGENT_SOCK=%s; export ENVCHAIN_AGENT_SOCK;\n", path);
+  fflush(stdout);
+
+  if (!foreground) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "%s: fork failed: %s\n", envchain_name, strerror(errno));
+      unlink(path);
+      return 1;
+    }
+    if (0 < pid) return 0;
+    setsid();
+
+    /* detach from the terminal and let `eval "$(envchain --agent)"` return */
+    int null_fd = open("/dev/null", O_RDWR);
+    if (0 <= null_fd) {
+      dup2(null_fd, STDIN_FILENO);
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+      if (STDERR_FILENO < null_fd) close(null_fd);
+    }
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &envchain_agent_terminate;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!envchain_agent_terminated) {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    time_t next_expiry = envchain_agent_cache_next_expiry();
+    int timeout = -1;
+
+    if (next_expiry != 0) {
+      time_t now = time(NULL);
+      time_t wait = next_expiry <= now ? 0 : next_expiry - now;
+      if (INT_MAX / 1000 < wait) wait = INT_MAX / 1000;
+      timeout = (int)wait * 1000;
+    }
+
+    int n = poll(&pfd, 1, timeout);
+    if (n < 0 && errno != EINTR) {
+      fprintf(stderr, "%s: poll failed: %s\n", envchain_name, strerror(errno));
+      break;
+    }
+
+    envchain_agent_cache_expire(time(NULL));
+
+    if (0 < n && (pfd.revents & POLLIN)) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd < 0) continue;
+      envchain_agent_handle(fd, (int)ttl);
+      close(fd);
+    }
+  }
+
+  envchain_agent_cache_clear();
+  close(listen_fd);
+  unlink(path);
+  free(path);
+  return 0;
+}
+
+/* client */
+
+/*
+ * Sends request to the socket at path and passes the entries of the response
+ * to callback, even for status 1 (some selectors failed) when partial is set.
+ * Returns -1 when no usable answer was received, otherwise the status.
+ */
+static int
+envchain_agent_request(const char *path, const envchain_agent_buffer *request, int partial,
+                       envchain_search_callback callback, void *data)
+{
+  uint32_t status, entries_count, i;
+  char **entries = NULL;
+  uint32_t *lens = NULL;
+  int fd, result = -1;
+
+  fd = envchain_agent_connect(path);
+  if (fd < 0) return -1;
+
+  if (envchain_agent_write_full(fd, request->buf, request->len) < 0) goto ensure;
+
+  if (envchain_agent_read_full(fd, &status, sizeof(status)) < 0) goto ensure;
+  if (envchain_agent_read_full(fd, &entries_count, sizeof(entries_count)) < 0) goto ensure;
+  if (status != 0 && !(partial && status == 1)) goto ensure;
+  if (ENVCHAIN_AGENT_MAX_ENTRIES < entries_count) goto ensure;
+
+  /* read everything before applying anything, so a broken reply falls back cleanly */
+  entries = calloc((size_t)entries_count * 2 + 1, sizeof(char*));
+  lens = calloc((size_t)entries_count * 2 + 1, sizeof(uint32_t));
+  if (entries == NULL || lens == NULL) goto ensure;
+  for (i = 0; i < entries_count * 2; i++) {
+    if (envchain_agent_read_field(fd, &entries[i], &lens[i]) < 0) goto ensure;
+  }
+
+  for (i = 0; i < entries_count; i++) {
+    callback(entries[i * 2], entries[i * 2 + 1], lens[i * 2 + 1], data);
+  }
+  result = status;
+
+ensure:
+  if (entries) {
+    for (i = 0; entries[i]; i++) {
+      memset(entries[i], 0, lens ? lens[i] : strlen(entries[i]));
+      free(entries[i]);
+    }
+    free(entries);
+  }
+  free(lens);
+  close(fd);
+  return result;
+}
+
+int
+envchain_agent_search_values(const envchain_selector *selectors, int selectors_count,
+                             envchain_search_callback callback, void *data)
+{
+  const char *path = getenv("ENVCHAIN_AGENT_SOCK");
+  envchain_agent_buffer request = {NULL, 0, 0, 0};
+  int result;
+
+  if (path == NULL || path[0] == '\0') return -1;
+
+  envchain_agent_buffer_append_selectors(&request, selectors, selectors_count);
+  result = envchain_agent_request(path, &request, 0, callback, data);
+  envchain_agent_buffer_free(&request);
+  return result;
+}
+
+/* coalescing */
+
+static int
+envchain_coalesce_enabled(void)
+{
+  const char *str = getenv("ENVCHAIN_COALESCE");
+  if (str == NULL || str[0] == '\0' || strcmp(str, "0") == 0) return 0;
+  /* the vault is a local file; only keyring services suffer from the herd */
+  return envchain_backend_get() != &envchain_backend_vault;
+}
+
+static int
+envchain_coalesce_linger_ms(void)
+{
+  const char *str = getenv("ENVCHAIN_COALESCE_LINGER_MS");
+  char *end;
+  long v;
+
+  if (str == NULL || str[0] == '\0') return ENVCHAIN_COALESCE_DEFAULT_LINGER_MS;
+  v = strtol(str, &end, 10);
+  if (*end != '\0' || v < 0 || ENVCHAIN_COALESCE_MAX_LINGER_MS < v) {
+    fprintf(stderr, "%s: ignoring invalid ENVCHAIN_COALESCE_LINGER_MS=%s\n", envchain_name, str);
+    return ENVCHAIN_COALESCE_DEFAULT_LINGER_MS;
+  }
+  return (int)v;
+}
+
+static uint64_t
+envchain_coalesce_hash(uint64_t hash, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static int64_t
+envchain_coalesce_now_ms(void)
+{
+  return (int64_t)(envchain_monotonic_ns() / 1000000);
+}
+
+/* A directory only the current user can write to, for the lock and socket */
+static char*
+envchain_coalesce_dir(void)
+{
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  char *dir = NULL;
+  struct stat st;
+
+  if (runtime_dir != NULL && runtime_dir[0] != '\0') return strdup(runtime_dir);
+
+  if (asprintf(&dir, "/tmp/envchain-coalesce-%d", (int)getuid()) < 0) return NULL;
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) goto fail;
+  if (lstat(dir, &st) < 0) goto fail;
+  if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) goto fail;
+  return dir;
+
+fail:
+  free(dir);
+  return NULL;
+}
+
+typedef struct {
+  envchain_search_callback callback;
+  void *data;
+  envchain_agent_buffer *response;
+  uint32_t entries_count;
+} envchain_coalesce_context;
+
+static void
+envchain_coalesce_value_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_coalesce_context *context = raw_context;
+
+  context->callback(key, value, value_len, context->data);
+  envchain_agent_buffer_append_field(context->response, key);
+  envchain_agent_buffer_append_bytes(context->response, value, value_len);
+  context->entries_count++;
+}
+
+static void
+envchain_coalesce_answer(int fd, const envchain_agent_buffer *request, char *received,
+                         const envchain_agent_buffer *response)
+{
+  static const uint32_t mismatch[2] = {2, 0};
+  struct timeval timeout = {1, 0};
+
+  if (!envchain_agent_peer_is_self(fd)) return;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (envchain_agent_read_full(fd, received, request->len) < 0) return;
+  if (memcmp(received, request->buf, request->len) != 0) {
+    envchain_agent_write_full(fd, mismatch, sizeof(mismatch));
+    return;
+  }
+  envchain_agent_write_full(fd, response->buf, response->len);
+}
+
+/* Closes the descriptors first..last without allocating, as helper threads may hold malloc locks */
+static void
+envchain_coalesce_close_range(unsigned int first, unsigned int last)
+{
+  long max;
+
+  if (last < first) return;
+#if defined(__linux__) && defined(SYS_close_range)
+  if (syscall(SYS_close_range, first, last, 0) == 0) return;
+#endif
+  max = sysconf(_SC_OPEN_MAX);
+  if (max < 0) max = 1024;
+  for (unsigned int fd = first; fd <= last && fd < (unsigned long)max; fd++) close(fd);
+}
+
+/* Closes every descriptor above stderr but the two given */
+static void
+envchain_coalesce_close_fds(int keep_a, int keep_b)
+{
+  unsigned int low = keep_a < keep_b ? keep_a : keep_b;
+  unsigned int high = keep_a < keep_b ? keep_b : keep_a;
+
+  envchain_coalesce_close_range(STDERR_FILENO + 1, low - 1);
+  envchain_coalesce_close_range(low + 1, high - 1);
+  envchain_coalesce_close_range(high + 1, ~0U);
+}
+
+/*
+ * Leaves a detached process behind that answers followers with response
+ * until the linger time is up. It keeps lock_fd, so no other leader is
+ * elected while it runs.
+ */
+static void
+envchain_coalesce_serve(int listen_fd, int lock_fd, const char *sock_path,
+                        const envchain_agent_buffer *request, envchain_agent_buffer *response)
+{
+  int linger_ms = envchain_coalesce_linger_ms();
+  int64_t deadline;
+  char *received;
+  pid_t pid;
+  int fd;
+
+  /* allocate up front; the fetch may have left helper threads behind */
+  received = malloc(request->len);
+  if (received == NULL) {
+    unlink(sock_path);
+    return;
+  }
+
+  pid = fork();
+  if (pid != 0) {
+    if (pid < 0) unlink(sock_path);
+    else while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+    free(received);
+    return;
+  }
+
+  /* fork again so the command exec'd by the leader never sees us as its child */
+  if (fork() != 0) _exit(0);
+  setsid();
+#ifdef __linux__
+  prctl(PR_SET_DUMPABLE, 0);
+#endif
+  /* memory locks are not inherited; best effort, like the arena */
+  mlock(response->buf, response->cap);
+  /* don't hold on to the leader's pipes, memfds or anything else it had open */
+  envchain_coalesce_close_fds(listen_fd, lock_fd);
+  fd = open("/dev/null", O_RDWR);
+  if (0 <= fd) {
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if (STDERR_FILENO < fd) close(fd);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  deadline = envchain_coalesce_now_ms() + linger_ms;
+  for (;;) {
+    int64_t remaining = deadline - envchain_coalesce_now_ms();
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+
+    if (remaining <= 0) break;
+    if (poll(&pfd, 1, (int)remaining) <= 0) continue;
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) continue;
+    envchain_coalesce_answer(fd, request, received, response);
+    close(fd);
+  }
+
+  /* stop taking new followers, then answer the ones already queued */
+  unlink(sock_path);
+  fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+    envchain_coalesce_answer(fd, request, received, response);
+    close(fd);
+  }
+
+  memset(response->buf, 0, response->cap);
+  _exit(0);
+}
+
+int
+envchain_coalesce_search_values(const envchain_selector *selectors, int selectors_count,
+                                envchain_search_callback callback, void *data)
+{
+  envchain_agent_buffer request = {NULL, 0, 0, 0}, response = {NULL, 0, 0, 1};
+  envchain_coalesce_context context = {callback, data, &response, 0};
+  const char *bus = getenv("DBUS_SESSION_BUS_ADDRESS");
+  const char *backend;
+  char *dir = NULL, *lock_path = NULL, *sock_path = NULL;
+  int lock_fd = -1, listen_fd = -1, result, waited;
+  uint32_t status = 0;
+  uint64_t hash = 14695981039346656037ull, trace_begin;
+
+  if (!envchain_coalesce_enabled()) {
+    return envchain_search_values_multi(selectors, selectors_count, callback, data);
+  }
+
+  /* invocations coalesce when they'd send the same request to the same keyring */
+  backend = envchain_backend_get()->name;
+  envchain_agent_buffer_append_selectors(&request, selectors, selectors_count);
+  hash = envchain_coalesce_hash(hash, backend, strlen(backend) + 1);
+  if (bus) hash = envchain_coalesce_hash(hash, bus, strlen(bus) + 1);
+  hash = envchain_coalesce_hash(hash, request.buf, request.len);
+
+  dir = envchain_coalesce_dir();
+  if (dir == NULL) goto direct;
+  if (asprintf(&lock_path, "%s/envchain-coalesce-%016llx.lock", dir, (unsigned long long)hash) < 0) {
+    lock_path = NULL;
+    goto direct;
+  }
+  if (asprintf(&sock_path, "%s/envchain-coalesce-%016llx.sock", dir, (unsigned long long)hash) < 0) {
+    sock_path = NULL;
+    goto direct;
+  }
+
+  lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (lock_fd < 0) goto direct;
+
+  trace_begin = envchain_trace_begin();
+  for (waited = 0; ; waited++) {
+    result = envchain_agent_request(sock_path, &request, 1, callback, data);
+    if (result != -1) {
+      envchain_trace_end(ENVCHAIN_TRACE_COALESCE, trace_begin);
+      goto ensure;
+    }
+    if (flock(lock_fd, LOCK_EX | LOCK_NB) == 0) break;
+    /* the lock holder is between locking and listening, or about to exit */
+    if ((errno != EWOULDBLOCK && errno != EINTR) || ENVCHAIN_COALESCE_WAIT_MS <= waited) {
+      envchain_trace_end(ENVCHAIN_TRACE_COALESCE, trace_begin);
+      goto direct;
+    }
+    usleep(1000);
+  }
+  envchain_trace_end(ENVCHAIN_TRACE_COALESCE, trace_begin);
+
+  /* leader: a socket left by a crashed leader is stale, we hold the lock */
+  unlink(sock_path);
+  listen_fd = envchain_agent_listen(sock_path);
+  if (listen_fd < 0) goto direct;
+  fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+  /* followers connecting during the fetch wait in the backlog */
+  envchain_agent_buffer_append(&response, &status, sizeof(status));
+  envchain_agent_buffer_append(&response, &context.entries_count, sizeof(context.entries_count));
+  result = envchain_search_values_multi(selectors, selectors_count,
+                                        &envchain_coalesce_value_callback, &context);
+  status = result != 0;
+  memcpy(response.buf, &status, sizeof(status));
+  memcpy(response.buf + sizeof(status), &context.entries_count, sizeof(context.entries_count));
+
+  envchain_coalesce_serve(listen_fd, lock_fd, sock_path, &request, &response);
+  goto ensure;
+
+direct:
+  result = envchain_search_values_multi(selectors, selectors_count, callback, data);
+
+ensure:
+  if (0 <= listen_fd) close(listen_fd);
+  if (0 <= lock_fd) close(lock_fd);
+  envchain_agent_buffer_free(&response);
+  envchain_agent_buffer_free(&request);
+  free(sock_path);
+  free(lock_path);
+  free(dir);
+  return result;
+}
@@ -0,0 +1,117 @@
+/*
+ * Arena for secret material. Exec mode copies every value once, straight
+ * into its "KEY=VALUE" entry here, and hands those entries to execve as they
+ * are. Chunks are locked into memory, excluded from core dumps where the
+ * platform allows, and zeroed all at once at exit.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "envchain.h"
+
+#define ENVCHAIN_ARENA_CHUNK_SIZE (64 * 1024)
+#define ENVCHAIN_ARENA_ALIGN 16
+
+typedef struct envchain_arena_chunk {
+  struct envchain_arena_chunk *next;
+  size_t size;
+  size_t used;
+} envchain_arena_chunk;
+
+static envchain_arena_chunk *envchain_arena_chunks = NULL;
+/* chunks a forked child keeps: the values the coalescing server hands out */
+static envchain_arena_chunk *envchain_arena_inherited_chunks = NULL;
+
+static envchain_arena_chunk*
+envchain_arena_chunk_new(size_t min_size, envchain_arena_chunk **list)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = ENVCHAIN_ARENA_CHUNK_SIZE;
+  envchain_arena_chunk *chunk;
+
+  min_size += sizeof(envchain_arena_chunk) + ENVCHAIN_ARENA_ALIGN;
+  if (size < min_size) size = (min_size + page - 1) / page * page;
+
+  chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (chunk == MAP_FAILED) {
+    fprintf(stderr, "%s: mmap failed\n", envchain_name);
+    exit(10);
+  }
+  /* best effort: RLIMIT_MEMLOCK may be small, and values are wiped regardless */
+  mlock(chunk, size);
+#ifdef MADV_DONTDUMP
+  madvise(chunk, size, MADV_DONTDUMP);
+#endif
+#ifdef MADV_WIPEONFORK
+  /* forked helpers (the coalescing server) don't need the other values */
+  if (list == &envchain_arena_chunks) madvise(chunk, size, MADV_WIPEONFORK);
+#endif
+
+  chunk->size = size;
+  chunk->used = (sizeof(envchain_arena_chunk) + ENVCHAIN_ARENA_ALIGN - 1) & ~(size_t)(ENVCHAIN_ARENA_ALIGN - 1);
+  chunk->next = *list;
+  *list = chunk;
+  return chunk;
+}
+
+static void*
+envchain_arena_alloc_from(size_t size, envchain_arena_chunk **list)
+{
+  static int registered = 0;
+  envchain_arena_chunk *chunk = *list;
+  void *ptr;
+
+  if (!registered) {
+    atexit(&envchain_arena_wipe);
+    registered = 1;
+  }
+
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk = envchain_arena_chunk_new(size, list);
+  }
+
+  ptr = (char*)chunk + chunk->used;
+  chunk->used = (chunk->used + size + ENVCHAIN_ARENA_ALIGN - 1) & ~(size_t)(ENVCHAIN_ARENA_ALIGN - 1);
+  if (chunk->size < chunk->used) chunk->used = chunk->size;
+  return ptr;
+}
+
+void*
+envchain_arena_alloc(size_t size)
+{
+  return envchain_arena_alloc_from(size, &envchain_arena_chunks);
+}
+
+void*
+envchain_arena_alloc_inherited(size_t size)
+{
+  return envchain_arena_alloc_from(size, &envchain_arena_inherited_chunks);
+}
+
+static void
+envchain_arena_wipe_list(envchain_arena_chunk **list)
+{
+  while (*list) {
+    envchain_arena_chunk *chunk = *list;
+    size_t size = chunk->size;
+
+    *list = chunk->next;
+    /* volatile, so the zeroing of memory about to be unmapped is not elided */
+    for (volatile char *p = (volatile char*)chunk; p < (volatile char*)chunk + size; p++) *p = 0;
+    munlock(chunk, size);
+    munmap(chunk, size);
+  }
+}
+
+void
+envchain_arena_wipe(void)
+{
+  envchain_arena_wipe_list(&envchain_arena_chunks);
+  envchain_arena_wipe_list(&envchain_arena_inherited_chunks);
+}
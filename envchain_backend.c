@@ -0,0 +1,131 @@
+/*
+ * Backend selection. ENVCHAIN_BACKEND names one of envchain_backends; when
+ * unset, the platform keychain is used as before.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "envchain.h"
+
+static const envchain_backend *envchain_backends[] = {
+#ifdef __APPLE__
+  &envchain_backend_keychain,
+#else
+  &envchain_backend_secret_service,
+#endif
+  &envchain_backend_vault,
+  NULL
+};
+
+static const envchain_backend *envchain_backend_current = NULL;
+
+void
+envchain_backend_set(const envchain_backend *selected)
+{
+  envchain_backend_current = selected;
+}
+
+const envchain_backend*
+envchain_backend_get(void)
+{
+  const char *name;
+  int i;
+
+  if (envchain_backend_current) return envchain_backend_current;
+
+  name = getenv("ENVCHAIN_BACKEND");
+  if (name == NULL || name[0] == '\0') {
+    envchain_backend_current = envchain_backends[0];
+    return envchain_backend_current;
+  }
+
+  for (i = 0; envchain_backends[i]; i++) {
+    if (strcmp(envchain_backends[i]->name, name) == 0) {
+      envchain_backend_current = envchain_backends[i];
+      return envchain_backend_current;
+    }
+  }
+
+  fprintf(stderr, "%s: unknown backend `%s'; available:", envchain_name, name);
+  for (i = 0; envchain_backends[i]; i++) fprintf(stderr, " %s", envchain_backends[i]->name);
+  fprintf(stderr, "\n");
+  exit(2);
+}
+
+int
+envchain_search_namespaces(envchain_namespace_search_callback callback, void *data)
+{
+  return envchain_backend_get()->search_namespaces(callback, data);
+}
+
+int
+envchain_search_keys(envchain_key_search_callback callback, void *data)
+{
+  return envchain_backend_get()->search_keys(callback, data);
+}
+
+int
+envchain_search_values(const char *name, envchain_search_callback callback, void *data)
+{
+  envchain_selector selector = {name, NULL, 0};
+  return envchain_backend_get()->search_values_multi(&selector, 1, callback, data);
+}
+
+int
+envchain_search_values_multi(const envchain_selector *selectors, int selectors_count,
+                             envchain_search_callback callback, void *data)
+{
+  return envchain_backend_get()->search_values_multi(selectors, selectors_count, callback, data);
+}
+
+void
+envchain_save_value(const char *name, const char *key, char *value, int require_passphrase)
+{
+  const char *v = value;
+  size_t len = strlen(value);
+  envchain_backend_get()->save_values(name, &key, &v, &len, 1, require_passphrase);
+}
+
+int
+envchain_save_values(const char *name, const char **keys, const char **values,
+                     const size_t *value_lens, int count, int require_passphrase)
+{
+  size_t *lens;
+  int result;
+
+  if (value_lens) {
+    return envchain_backend_get()->save_values(name, keys, values, value_lens, count,
+                                               require_passphrase);
+  }
+
+  lens = malloc(sizeof(size_t) * (count + 1));
+  if (lens == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  for (int i = 0; i < count; i++) lens[i] = strlen(values[i]);
+  result = envchain_backend_get()->save_values(name, keys, values, lens, count, require_passphrase);
+  free(lens);
+  return result;
+}
+
+static int
+envchain_delete_value_match(const char *name, const char *key, void *data)
+{
+  (void)name;
+  return strcmp(key, (const char*)data) == 0;
+}
+
+void
+envchain_delete_value(const char *name, const char *key)
+{
+  envchain_backend_get()->delete_values(name, &envchain_delete_value_match, (void*)key);
+}
+
+int
+envchain_delete_values(const char *name, envchain_key_match_callback match, void *data)
+{
+  return envchain_backend_get()->delete_values(name, match, data);
+}
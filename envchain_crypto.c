@@ -0,0 +1,311 @@
+/*
+ * ChaCha20-Poly1305 AEAD (RFC 8439) for the file vault. Self-contained so
+ * the vault backend needs no crypto library beyond what the OS provides.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "envchain.h"
+
+#define ENVCHAIN_ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define ENVCHAIN_QUARTERROUND(a, b, c, d) \
+  a += b; d ^= a; d = ENVCHAIN_ROTL32(d, 16); \
+  c += d; b ^= c; b = ENVCHAIN_ROTL32(b, 12); \
+  a += b; d ^= a; d = ENVCHAIN_ROTL32(d, 8); \
+  c += d; b ^= c; b = ENVCHAIN_ROTL32(b, 7);
+
+typedef struct {
+  uint32_t r[5];
+  uint32_t h[5];
+  uint32_t pad[4];
+  unsigned char buf[16];
+  size_t leftover;
+} envchain_poly1305;
+
+static uint32_t
+envchain_load32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void
+envchain_store32(unsigned char *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+envchain_store64(unsigned char *p, uint64_t v)
+{
+  envchain_store32(p, (uint32_t)v);
+  envchain_store32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* ChaCha20 */
+
+static void
+envchain_chacha20_block(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE], uint32_t counter,
+                        const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE], unsigned char out[64])
+{
+  uint32_t input[16], x[16];
+  int i;
+
+  input[0] = 0x61707865; input[1] = 0x3320646e; input[2] = 0x79622d32; input[3] = 0x6b206574;
+  for (i = 0; i < 8; i++) input[4 + i] = envchain_load32(key + i * 4);
+  input[12] = counter;
+  for (i = 0; i < 3; i++) input[13 + i] = envchain_load32(nonce + i * 4);
+
+  memcpy(x, input, sizeof(x));
+  for (i = 0; i < 10; i++) {
+    ENVCHAIN_QUARTERROUND(x[0], x[4], x[8], x[12]);
+    ENVCHAIN_QUARTERROUND(x[1], x[5], x[9], x[13]);
+    ENVCHAIN_QUARTERROUND(x[2], x[6], x[10], x[14]);
+    ENVCHAIN_QUARTERROUND(x[3], x[7], x[11], x[15]);
+    ENVCHAIN_QUARTERROUND(x[0], x[5], x[10], x[15]);
+    ENVCHAIN_QUARTERROUND(x[1], x[6], x[11], x[12]);
+    ENVCHAIN_QUARTERROUND(x[2], x[7], x[8], x[13]);
+    ENVCHAIN_QUARTERROUND(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; i++) envchain_store32(out + i * 4, x[i] + input[i]);
+
+  memset(x, 0, sizeof(x));
+  memset(input, 0, sizeof(input));
+}
+
+static void
+envchain_chacha20_xor(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE], uint32_t counter,
+                      const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                      const unsigned char *in, unsigned char *out, size_t len)
+{
+  unsigned char block[64];
+
+  while (0 < len) {
+    size_t n = len < 64 ? len : 64;
+    envchain_chacha20_block(key, counter++, nonce, block);
+    for (size_t i = 0; i < n; i++) out[i] = in[i] ^ block[i];
+    in += n; out += n; len -= n;
+  }
+  memset(block, 0, sizeof(block));
+}
+
+/* Poly1305, 26-bit limbs */
+
+static void
+envchain_poly1305_init(envchain_poly1305 *st, const unsigned char key[32])
+{
+  st->r[0] = envchain_load32(key + 0) & 0x3ffffff;
+  st->r[1] = (envchain_load32(key + 3) >> 2) & 0x3ffff03;
+  st->r[2] = (envchain_load32(key + 6) >> 4) & 0x3ffc0ff;
+  st->r[3] = (envchain_load32(key + 9) >> 6) & 0x3f03fff;
+  st->r[4] = (envchain_load32(key + 12) >> 8) & 0x00fffff;
+  for (int i = 0; i < 5; i++) st->h[i] = 0;
+  for (int i = 0; i < 4; i++) st->pad[i] = envchain_load32(key + 16 + i * 4);
+  st->leftover = 0;
+}
+
+static void
+envchain_poly1305_blocks(envchain_poly1305 *st, const unsigned char *m, size_t bytes, int final)
+{
+  const uint32_t hibit = final ? 0 : (1UL << 24);
+  const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+  const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+  uint64_t d0, d1, d2, d3, d4;
+  uint32_t c;
+
+  while (16 <= bytes) {
+    h0 += envchain_load32(m + 0) & 0x3ffffff;
+    h1 += (envchain_load32(m + 3) >> 2) & 0x3ffffff;
+    h2 += (envchain_load32(m + 6) >> 4) & 0x3ffffff;
+    h3 += (envchain_load32(m + 9) >> 6) & 0x3ffffff;
+    h4 += (envchain_load32(m + 12) >> 8) | hibit;
+
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+    d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+    d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+    d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+    d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    m += 16; bytes -= 16;
+  }
+
+  st->h[0] = h0; st->h[1] = h1; st->h[2] = h2; st->h[3] = h3; st->h[4] = h4;
+}
+
+static void
+envchain_poly1305_update(envchain_poly1305 *st, const unsigned char *m, size_t bytes)
+{
+  if (st->leftover) {
+    size_t want = 16 - st->leftover;
+    if (bytes < want) want = bytes;
+    memcpy(st->buf + st->leftover, m, want);
+    st->leftover += want;
+    m += want; bytes -= want;
+    if (st->leftover < 16) return;
+    envchain_poly1305_blocks(st, st->buf, 16, 0);
+    st->leftover = 0;
+  }
+  if (16 <= bytes) {
+    size_t want = bytes & ~(size_t)15;
+    envchain_poly1305_blocks(st, m, want, 0);
+    m += want; bytes -= want;
+  }
+  if (bytes) {
+    memcpy(st->buf, m, bytes);
+    st->leftover = bytes;
+  }
+}
+
+/* Pads the message so far to a multiple of 16 bytes with zeros, as RFC 8439 does between parts */
+static void
+envchain_poly1305_pad16(envchain_poly1305 *st)
+{
+  static const unsigned char zeros[16];
+  if (st->leftover) envchain_poly1305_update(st, zeros, 16 - st->leftover);
+}
+
+static void
+envchain_poly1305_finish(envchain_poly1305 *st, unsigned char mac[ENVCHAIN_AEAD_TAG_SIZE])
+{
+  uint32_t h0, h1, h2, h3, h4, c;
+  uint32_t g0, g1, g2, g3, g4, mask;
+  uint64_t f;
+
+  if (st->leftover) {
+    st->buf[st->leftover] = 1;
+    for (size_t i = st->leftover + 1; i < 16; i++) st->buf[i] = 0;
+    envchain_poly1305_blocks(st, st->buf, 16, 1);
+  }
+
+  h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2]; h3 = st->h[3]; h4 = st->h[4];
+
+  c = h1 >> 26; h1 &= 0x3ffffff;
+  h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+  h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+  h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+  h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+  h1 += c;
+
+  /* compute h - p and select it when h >= p, in constant time */
+  g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+  g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+  g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+  g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+  g4 = h4 + c - (1UL << 26);
+
+  mask = (g4 >> 31) - 1;
+  g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+  mask = ~mask;
+  h0 = (h0 & mask) | g0;
+  h1 = (h1 & mask) | g1;
+  h2 = (h2 & mask) | g2;
+  h3 = (h3 & mask) | g3;
+  h4 = (h4 & mask) | g4;
+
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+
+  f = (uint64_t)h0 + st->pad[0]; h0 = (uint32_t)f;
+  f = (uint64_t)h1 + st->pad[1] + (f >> 32); h1 = (uint32_t)f;
+  f = (uint64_t)h2 + st->pad[2] + (f >> 32); h2 = (uint32_t)f;
+  f = (uint64_t)h3 + st->pad[3] + (f >> 32); h3 = (uint32_t)f;
+
+  envchain_store32(mac + 0, h0);
+  envchain_store32(mac + 4, h1);
+  envchain_store32(mac + 8, h2);
+  envchain_store32(mac + 12, h3);
+
+  memset(st, 0, sizeof(*st));
+}
+
+/* AEAD */
+
+static void
+envchain_aead_tag(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                  const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                  const unsigned char *aad, size_t aad_len,
+                  const unsigned char *cipher, size_t len,
+                  unsigned char tag[ENVCHAIN_AEAD_TAG_SIZE])
+{
+  unsigned char block[64], lengths[16];
+  envchain_poly1305 st;
+
+  envchain_chacha20_block(key, 0, nonce, block);
+  envchain_poly1305_init(&st, block);
+  memset(block, 0, sizeof(block));
+
+  envchain_poly1305_update(&st, aad, aad_len);
+  envchain_poly1305_pad16(&st);
+  envchain_poly1305_update(&st, cipher, len);
+  envchain_poly1305_pad16(&st);
+  envchain_store64(lengths, aad_len);
+  envchain_store64(lengths + 8, len);
+  envchain_poly1305_update(&st, lengths, sizeof(lengths));
+  envchain_poly1305_finish(&st, tag);
+}
+
+void
+envchain_aead_seal(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                   const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                   const unsigned char *aad, size_t aad_len,
+                   const unsigned char *plain, size_t len,
+                   unsigned char *cipher, unsigned char tag[ENVCHAIN_AEAD_TAG_SIZE])
+{
+  envchain_chacha20_xor(key, 1, nonce, plain, cipher, len);
+  envchain_aead_tag(key, nonce, aad, aad_len, cipher, len, tag);
+}
+
+int
+envchain_aead_open(const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                   const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE],
+                   const unsigned char *aad, size_t aad_len,
+                   const unsigned char *cipher, size_t len,
+                   const unsigned char tag[ENVCHAIN_AEAD_TAG_SIZE], unsigned char *plain)
+{
+  unsigned char expected[ENVCHAIN_AEAD_TAG_SIZE];
+  unsigned char diff = 0;
+
+  envchain_aead_tag(key, nonce, aad, aad_len, cipher, len, expected);
+  for (int i = 0; i < ENVCHAIN_AEAD_TAG_SIZE; i++) diff |= expected[i] ^ tag[i];
+  if (diff != 0) return -1;
+
+  envchain_chacha20_xor(key, 1, nonce, cipher, plain, len);
+  return 0;
+}
+
+int
+envchain_random_bytes(unsigned char *buf, size_t len)
+{
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  while (0 < len) {
+    ssize_t n = read(fd, buf, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      close(fd);
+      return -1;
+    }
+    buf += n; len -= n;
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * Environment table for exec mode. Values are collected into a hash table
+ * keyed by variable name (later values replace earlier ones), and the final
+ * envp array is built once from it and the current environ. Entries live in
+ * the secret arena.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+
+#include "envchain.h"
+
+extern char **environ;
+
+struct envchain_env {
+  char **entries; /* "KEY=VALUE", in insertion order */
+  size_t *key_lens;
+  size_t *value_lens;
+  size_t count;
+  size_t capacity;
+  size_t *index; /* open addressing; slot holds entry position + 1 */
+  size_t index_size;
+};
+
+static uint32_t
+envchain_env_hash(const char *key, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void*
+envchain_env_alloc(size_t size)
+{
+  void *ptr = calloc(1, size);
+  if (ptr == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  return ptr;
+}
+
+/* Returns the slot for key: either holding it, or the empty one to insert at */
+static size_t*
+envchain_env_slot(envchain_env *env, const char *key, size_t len)
+{
+  size_t mask = env->index_size - 1;
+  size_t i = envchain_env_hash(key, len) & mask;
+
+  while (env->index[i] != 0) {
+    size_t pos = env->index[i] - 1;
+    if (env->key_lens[pos] == len && memcmp(env->entries[pos], key, len) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+  return &env->index[i];
+}
+
+static void
+envchain_env_grow(envchain_env *env)
+{
+  size_t capacity = env->capacity ? env->capacity * 2 : 32;
+  char **entries = envchain_env_alloc(sizeof(char*) * capacity);
+  size_t *key_lens = envchain_env_alloc(sizeof(size_t) * capacity);
+  size_t *value_lens = envchain_env_alloc(sizeof(size_t) * capacity);
+
+  if (env->count) {
+    memcpy(entries, env->entries, sizeof(char*) * env->count);
+    memcpy(key_lens, env->key_lens, sizeof(size_t) * env->count);
+    memcpy(value_lens, env->value_lens, sizeof(size_t) * env->count);
+  }
+  free(env->entries);
+  free(env->key_lens);
+  free(env->value_lens);
+  env->entries = entries;
+  env->key_lens = key_lens;
+  env->value_lens = value_lens;
+  env->capacity = capacity;
+
+  /* keep the load factor of the index at or below 1/2 */
+  free(env->index);
+  env->index_size = capacity * 2;
+  env->index = envchain_env_alloc(sizeof(size_t) * env->index_size);
+  for (size_t pos = 0; pos < env->count; pos++) {
+    *envchain_env_slot(env, env->entries[pos], env->key_lens[pos]) = pos + 1;
+  }
+}
+
+envchain_env*
+envchain_env_new(void)
+{
+  envchain_env *env = envchain_env_alloc(sizeof(envchain_env));
+  envchain_env_grow(env);
+  return env;
+}
+
+void
+envchain_env_set(envchain_env *env, const char *key, const char *value, size_t value_len)
+{
+  size_t key_len = strlen(key);
+  char *entry = envchain_arena_alloc(key_len + value_len + 2);
+  size_t *slot;
+
+  memcpy(entry, key, key_len);
+  entry[key_len] = '=';
+  memcpy(entry + key_len + 1, value, value_len);
+  entry[key_len + 1 + value_len] = '\0';
+
+  slot = envchain_env_slot(env, key, key_len);
+  if (*slot != 0) {
+    size_t pos = *slot - 1;
+    memset(env->entries[pos], 0, key_len + 1 + env->value_lens[pos]);
+    env->entries[pos] = entry;
+    env->value_lens[pos] = value_len;
+    return;
+  }
+
+  if (env->count == env->capacity) {
+    envchain_env_grow(env);
+    slot = envchain_env_slot(env, key, key_len);
+  }
+  env->entries[env->count] = entry;
+  env->key_lens[env->count] = key_len;
+  env->value_lens[env->count] = value_len;
+  env->count++;
+  *slot = env->count;
+}
+
+const char*
+envchain_env_get(envchain_env *env, const char *key)
+{
+  size_t value_len;
+  return envchain_env_get_len(env, key, &value_len);
+}
+
+const char*
+envchain_env_get_len(envchain_env *env, const char *key, size_t *value_len)
+{
+  size_t key_len = strlen(key);
+  size_t *slot = envchain_env_slot(env, key, key_len);
+  if (*slot == 0) return NULL;
+  *value_len = env->value_lens[*slot - 1];
+  return env->entries[*slot - 1] + key_len + 1;
+}
+
+void
+envchain_env_foreach(envchain_env *env, envchain_search_callback callback, void *data)
+{
+  for (size_t pos = 0; pos < env->count; pos++) {
+    size_t key_len = env->key_lens[pos];
+    char *key = envchain_env_alloc(key_len + 1);
+
+    memcpy(key, env->entries[pos], key_len);
+    callback(key, env->entries[pos] + key_len + 1, env->value_lens[pos], data);
+    free(key);
+  }
+}
+
+char**
+envchain_env_build(envchain_env *env, size_t *bytes)
+{
+  size_t base_count = 0, n = 0;
+  char **envp, **p;
+
+  for (p = environ; p && *p; p++) base_count++;
+
+  envp = envchain_env_alloc(sizeof(char*) * (base_count + env->count + 1));
+  *bytes = 0;
+
+  for (p = environ; p && *p; p++) {
+    const char *eq = strchr(*p, '=');
+    size_t key_len = eq ? (size_t)(eq - *p) : strlen(*p);
+    if (*envchain_env_slot(env, *p, key_len) != 0) continue;
+    envp[n++] = *p;
+    *bytes += strlen(*p) + 1 + sizeof(char*);
+  }
+  for (size_t pos = 0; pos < env->count; pos++) {
+    size_t len = env->key_lens[pos] + 1 + env->value_lens[pos];
+    if (memchr(env->entries[pos], '\0', len) != NULL) {
+      fprintf(stderr, "WARNING: `%.*s` contains NUL bytes and is left out of the environment.\n",
+              (int)env->key_lens[pos], env->entries[pos]);
+      continue;
+    }
+    envp[n++] = env->entries[pos];
+    *bytes += len + 1 + sizeof(char*);
+  }
+  envp[n] = NULL;
+  *bytes += sizeof(char*);
+
+  return envp;
+}
+
+void
+envchain_env_free(envchain_env *env)
+{
+  for (size_t pos = 0; pos < env->count; pos++) {
+    memset(env->entries[pos], 0, env->key_lens[pos] + 1 + env->value_lens[pos]);
+  }
+  free(env->entries);
+  free(env->key_lens);
+  free(env->value_lens);
+  free(env->index);
+  free(env);
+}
+
+typedef int (*envchain_run_func)(const char *path, char **argv, char **envp, void *data);
+
+static int
+envchain_run_execve(const char *path, char **argv, char **envp, void *data)
+{
+  (void)data;
+  execve(path, argv, envp);
+  return errno;
+}
+
+static int
+envchain_run_spawn(const char *path, char **argv, char **envp, void *data)
+{
+  return posix_spawn((pid_t*)data, path, NULL, NULL, argv, envp);
+}
+
+/* Like execvp(3), run files without a #! line with /bin/sh; returns an errno value */
+static int
+envchain_run_file(envchain_run_func run, void *data, const char *path, char **argv, char **envp)
+{
+  int err = run(path, argv, envp, data);
+  if (err != ENOEXEC) return err;
+
+  size_t argc = 0;
+  while (argv[argc]) argc++;
+
+  char **sh_argv = envchain_env_alloc(sizeof(char*) * (argc + 2));
+  sh_argv[0] = "/bin/sh";
+  sh_argv[1] = (char*)path;
+  if (1 < argc) memcpy(sh_argv + 2, argv + 1, sizeof(char*) * (argc - 1));
+
+  err = run("/bin/sh", sh_argv, envp, data);
+  free(sh_argv);
+  return err == 0 ? 0 : ENOEXEC;
+}
+
+/* Looks file up in the PATH of envp, running candidates until one starts */
+static int
+envchain_run_path(envchain_run_func run, void *data, const char *file, char **argv, char **envp)
+{
+  const char *path = NULL;
+  char *default_path = NULL;
+  int saw_eacces = 0, err;
+
+  if (strchr(file, '/') != NULL) {
+    return envchain_run_file(run, data, file, argv, envp);
+  }
+
+  for (char **p = envp; *p; p++) {
+    if (strncmp(*p, "PATH=", 5) == 0) {
+      path = *p + 5;
+      break;
+    }
+  }
+  if (path == NULL) {
+    size_t len = confstr(_CS_PATH, NULL, 0);
+    default_path = envchain_env_alloc(len + 1);
+    confstr(_CS_PATH, default_path, len);
+    path = default_path;
+  }
+
+  size_t file_len = strlen(file);
+  char *candidate = envchain_env_alloc(strlen(path) + file_len + 2);
+
+  while (1) {
+    const char *end = strchr(path, ':');
+    size_t dir_len = end ? (size_t)(end - path) : strlen(path);
+
+    if (dir_len == 0) {
+      memcpy(candidate, file, file_len + 1);
+    }
+    else {
+      memcpy(candidate, path, dir_len);
+      candidate[dir_len] = '/';
+      memcpy(candidate + dir_len + 1, file, file_len + 1);
+    }
+
+    err = envchain_run_file(run, data, candidate, argv, envp);
+    if (err == 0) break;
+    if (err == EACCES) saw_eacces = 1;
+    else if (err != ENOENT && err != ENOTDIR) break;
+
+    if (end == NULL) break;
+    path = end + 1;
+  }
+
+  if (saw_eacces && (err == ENOENT || err == ENOTDIR)) err = EACCES;
+  free(candidate);
+  free(default_path);
+  return err;
+}
+
+/* execvp(3) equivalent taking an explicit environment; PATH is looked up in envp */
+int
+envchain_execvpe(const char *file, char **argv, char **envp)
+{
+  errno = envchain_run_path(&envchain_run_execve, NULL, file, argv, envp);
+  return -1;
+}
+
+/*
+ * The same with posix_spawn(3), which unlike fork(2) leaves the arena (wiped
+ * on fork) readable until the command has started
+ */
+int
+envchain_spawnvpe(pid_t *pid, const char *file, char **argv, char **envp)
+{
+  int err = envchain_run_path(&envchain_run_spawn, pid, file, argv, envp);
+  if (err == 0) return 0;
+  errno = err;
+  return -1;
+}
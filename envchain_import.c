@@ -0,0 +1,304 @@
+/*
+ * envchain --set --import: read KEY=VALUE (dotenv) lines or NDJSON objects
+ * from a stream and store them with a single envchain_save_values() call.
+ *
+ *   # dotenv
+ *   export AWS_ACCESS_KEY_ID=my-access-key
+ *   AWS_SECRET_ACCESS_KEY="secret\nwith newline"
+ *   OTHER='literal $value'
+ *
+ *   # NDJSON, one object per line, every member is stored
+ *   {"AWS_ACCESS_KEY_ID": "my-access-key", "AWS_SECRET_ACCESS_KEY": "secret"}
+ *
+ * JSON values may contain \u0000; keys may not.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "envchain.h"
+
+typedef struct {
+  char **keys;
+  char **values;
+  size_t *value_lens;
+  int count;
+  int capacity;
+} envchain_import_list;
+
+static void
+envchain_import_add(envchain_import_list *list, char *key, char *value, size_t value_len)
+{
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 64;
+    list->keys = realloc(list->keys, sizeof(char*) * list->capacity);
+    list->values = realloc(list->values, sizeof(char*) * list->capacity);
+    list->value_lens = realloc(list->value_lens, sizeof(size_t) * list->capacity);
+    if (list->keys == NULL || list->values == NULL || list->value_lens == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+  list->keys[list->count] = key;
+  list->values[list->count] = value;
+  list->value_lens[list->count] = value_len;
+  list->count++;
+}
+
+static const char*
+envchain_import_skip_space(const char *p)
+{
+  while (*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+static void
+envchain_import_put_utf8(char **out, unsigned long cp)
+{
+  char *o = *out;
+  if (cp < 0x80) {
+    *o++ = cp;
+  }
+  else if (cp < 0x800) {
+    *o++ = 0xC0 | (cp >> 6);
+    *o++ = 0x80 | (cp & 0x3F);
+  }
+  else if (cp < 0x10000) {
+    *o++ = 0xE0 | (cp >> 12);
+    *o++ = 0x80 | ((cp >> 6) & 0x3F);
+    *o++ = 0x80 | (cp & 0x3F);
+  }
+  else {
+    *o++ = 0xF0 | (cp >> 18);
+    *o++ = 0x80 | ((cp >> 12) & 0x3F);
+    *o++ = 0x80 | ((cp >> 6) & 0x3F);
+    *o++ = 0x80 | (cp & 0x3F);
+  }
+  *out = o;
+}
+
+static int
+envchain_import_hex4(const char *p, unsigned long *cp)
+{
+  *cp = 0;
+  for (int i = 0; i < 4; i++) {
+    if (!isxdigit((unsigned char)p[i])) return -1;
+    *cp = (*cp << 4) | (isdigit((unsigned char)p[i]) ? p[i] - '0' : (tolower((unsigned char)p[i]) - 'a' + 10));
+  }
+  return 0;
+}
+
+/*
+ * Parses a JSON string starting at the opening quote; len receives its length,
+ * as it may contain NULs. Returns NULL on error.
+ */
+static char*
+envchain_import_json_string(const char **pp, size_t *len)
+{
+  const char *p = *pp + 1;
+  char *str = malloc(strlen(p) + 1), *o = str;
+  unsigned long cp, low;
+
+  if (str == NULL) return NULL;
+
+  while (*p != '"') {
+    if (*p == '\0' || (unsigned char)*p < 0x20) goto fail;
+    if (*p != '\\') {
+      *o++ = *p++;
+      continue;
+    }
+    p++;
+    switch (*p) {
+      case '"': case '\\': case '/': *o++ = *p; break;
+      case 'b': *o++ = '\b'; break;
+      case 'f': *o++ = '\f'; break;
+      case 'n': *o++ = '\n'; break;
+      case 'r': *o++ = '\r'; break;
+      case 't': *o++ = '\t'; break;
+      case 'u':
+        if (envchain_import_hex4(p + 1, &cp) < 0) goto fail;
+        p += 4;
+        if (0xD800 <= cp && cp <= 0xDBFF) {
+          if (p[1] != '\\' || p[2] != 'u' || envchain_import_hex4(p + 3, &low) < 0) goto fail;
+          if (low < 0xDC00 || 0xDFFF < low) goto fail;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        }
+        envchain_import_put_utf8(&o, cp);
+        break;
+      default:
+        goto fail;
+    }
+    p++;
+  }
+  *o = '\0';
+  *len = o - str;
+  *pp = p + 1;
+  return str;
+
+fail:
+  free(str);
+  return NULL;
+}
+
+static int
+envchain_import_parse_json(const char *line, envchain_import_list *list)
+{
+  const char *p = envchain_import_skip_space(line) + 1;
+  char *key, *value;
+  size_t key_len, value_len;
+
+  p = envchain_import_skip_space(p);
+  if (*p == '}') return 0;
+
+  while (1) {
+    if (*p != '"' || (key = envchain_import_json_string(&p, &key_len)) == NULL) return -1;
+    p = envchain_import_skip_space(p);
+    if (*p != ':' || strlen(key) != key_len) {
+      free(key);
+      return -1;
+    }
+    p = envchain_import_skip_space(p + 1);
+    if (*p != '"' || (value = envchain_import_json_string(&p, &value_len)) == NULL) {
+      free(key);
+      return -1;
+    }
+    envchain_import_add(list, key, value, value_len);
+
+    p = envchain_import_skip_space(p);
+    if (*p == '}') break;
+    if (*p != ',') return -1;
+    p = envchain_import_skip_space(p + 1);
+  }
+
+  p = envchain_import_skip_space(p + 1);
+  return *p == '\0' ? 0 : -1;
+}
+
+static int
+envchain_import_parse_dotenv(const char *line, envchain_import_list *list)
+{
+  const char *p = envchain_import_skip_space(line);
+  const char *key_begin, *key_end;
+  char *key, *value, *o;
+
+  if (strncmp(p, "export", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) {
+    p = envchain_import_skip_space(p + 6);
+  }
+
+  key_begin = p;
+  while (*p == '_' || isalnum((unsigned char)*p)) p++;
+  key_end = p;
+  if (key_begin == key_end) return -1;
+
+  p = envchain_import_skip_space(p);
+  if (*p != '=') return -1;
+  p = envchain_import_skip_space(p + 1);
+
+  value = malloc(strlen(p) + 1);
+  if (value == NULL) return -1;
+  o = value;
+
+  if (*p == '"') {
+    for (p++; *p != '"'; p++) {
+      if (*p == '\0') goto fail;
+      if (*p == '\\' && p[1] != '\0') {
+        p++;
+        switch (*p) {
+          case 'n': *o++ = '\n'; break;
+          case 'r': *o++ = '\r'; break;
+          case 't': *o++ = '\t'; break;
+          default: *o++ = *p; break;
+        }
+      }
+      else {
+        *o++ = *p;
+      }
+    }
+    p++;
+  }
+  else if (*p == '\'') {
+    for (p++; *p != '\''; p++) {
+      if (*p == '\0') goto fail;
+      *o++ = *p;
+    }
+    p++;
+  }
+  else {
+    /* unquoted; a # preceded by whitespace starts a comment */
+    for (; *p != '\0'; p++) {
+      if (*p == '#' && o != value && (o[-1] == ' ' || o[-1] == '\t')) break;
+      *o++ = *p;
+    }
+    while (o != value && (o[-1] == ' ' || o[-1] == '\t')) o--;
+    p = "";
+  }
+  *o = '\0';
+
+  p = envchain_import_skip_space(p);
+  if (*p != '\0' && *p != '#') goto fail;
+
+  key = strndup(key_begin, key_end - key_begin);
+  envchain_import_add(list, key, value, o - value);
+  return 0;
+
+fail:
+  free(value);
+  return -1;
+}
+
+int
+envchain_import(const char *name, FILE *input, int require_passphrase)
+{
+  envchain_import_list list = {NULL, NULL, NULL, 0, 0};
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  int lineno = 0, parse_errors = 0, failures = 0;
+
+  while ((len = getline(&line, &line_cap, input)) >= 0) {
+    const char *p;
+    int result;
+
+    lineno++;
+    while (0 < len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+
+    p = envchain_import_skip_space(line);
+    if (*p == '\0' || *p == '#') continue;
+
+    if (*p == '{') result = envchain_import_parse_json(p, &list);
+    else result = envchain_import_parse_dotenv(p, &list);
+
+    if (result < 0) {
+      fprintf(stderr, "%s: line %d: unable to parse\n", envchain_name, lineno);
+      parse_errors++;
+    }
+  }
+  if (line) {
+    memset(line, 0, line_cap);
+    free(line);
+  }
+
+  if (parse_errors == 0 && 0 < list.count) {
+    failures = envchain_save_values(name, (const char**)list.keys, (const char**)list.values,
+                                    list.value_lens, list.count, require_passphrase);
+  }
+  else if (parse_errors) {
+    fprintf(stderr, "%s: nothing stored due to parse errors\n", envchain_name);
+  }
+
+  for (int i = 0; i < list.count; i++) {
+    memset(list.values[i], 0, list.value_lens[i]);
+    free(list.keys[i]);
+    free(list.values[i]);
+  }
+  free(list.keys);
+  free(list.values);
+  free(list.value_lens);
+
+  return (parse_errors || failures) ? 1 : 0;
+}
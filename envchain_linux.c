@@ -1,6 +1,15 @@
 #include "envchain.h"
+#include <glib-unix.h>
 #include <libsecret/secret.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENVCHAIN_MAX_PENDING_STORES 16
+#define ENVCHAIN_DEFAULT_RETRY_ATTEMPTS 3
+#define ENVCHAIN_DEFAULT_RETRY_BACKOFF_MS 50
+#define ENVCHAIN_MAX_RETRY_SETTING 60000
+#define ENVCHAIN_WATCH_SETTLE_MS 200
 
 static const SecretSchema *envchain_get_schema(void) {
   static const SecretSchema the_schema = {
@@ -16,88 +25,325 @@ static const SecretSchema *envchain_get_schema(void) {
   return &the_schema;
 }
 
-static GList *search_unlocked_collection(const char *name, GError **error) {
-  SecretService *service =
-      secret_service_get_sync(SECRET_SERVICE_LOAD_COLLECTIONS, NULL, error);
-  if (*error != NULL) {
-    return NULL;
+/*
+ * Searches and secret loads run as async calls on a private GMainContext:
+ * one SearchItems per selector, all in flight at once, and each search's
+ * secrets are loaded as soon as its items are known. Results are kept per
+ * search and merged in selector order once everything has completed.
+ */
+typedef struct envchain_fetch envchain_fetch;
+
+typedef struct {
+  envchain_fetch *fetch;
+  const envchain_selector *selector; // NULL matches every envchain item
+  GList *items;                      // matched, in the order of the service
+  gboolean waiting_unlock;
+} envchain_fetch_search;
+
+struct envchain_fetch {
+  envchain_fetch_search *searches;
+  int searches_count;
+  gboolean load_secrets;
+  SecretService *service;
+  SecretCollection *collection;
+  GList *locked;
+  GHashTable *values; // item -> SecretValue
+  GList *failed;      // items whose secret failed with a retryable error
+  int pending;        // async calls in flight
+  int searching;
+  int loading;
+  uint64_t connect_begin;
+  uint64_t search_begin;
+  uint64_t unlock_begin;
+  uint64_t load_begin;
+  int result;
+};
+
+typedef struct {
+  envchain_fetch *fetch;
+  SecretItem *item;
+} envchain_fetch_load;
+
+static void report_error(envchain_fetch *fetch, const char *call,
+                         GError *error) {
+  fprintf(stderr, "%s: %s failed with %d: %s\n", envchain_name, call,
+          error->code, error->message);
+  g_error_free(error);
+  fetch->result = 1;
+}
+
+static void on_secret_loaded(GObject *source, GAsyncResult *result,
+                             gpointer user_data) {
+  envchain_fetch_load *load = user_data;
+  envchain_fetch *fetch = load->fetch;
+  GError *error = NULL;
+
+  if (secret_item_load_secret_finish((SecretItem *)source, result, &error)) {
+    SecretValue *value = secret_item_get_secret(load->item);
+    if (value != NULL) {
+      g_hash_table_insert(fetch->values, load->item, value);
+    } else {
+      fetch->failed = g_list_prepend(fetch->failed, load->item);
+    }
+  } else if (error->code == SECRET_ERROR_PROTOCOL) {
+    fetch->failed = g_list_prepend(fetch->failed, load->item);
+    g_error_free(error);
+  } else {
+    report_error(fetch, "secret_item_load_secret", error);
   }
 
-  SecretCollection *collection = secret_collection_for_alias_sync(
-      service, SECRET_COLLECTION_DEFAULT, SECRET_COLLECTION_LOAD_ITEMS, NULL,
-      error);
-  g_object_unref(service);
-  if (*error != NULL) {
-    return NULL;
+  if (--fetch->loading == 0) {
+    envchain_trace_end(ENVCHAIN_TRACE_LOAD, fetch->load_begin);
   }
-  if (collection == NULL) {
-    // Default collection does not exist
-    return NULL;
+  fetch->pending--;
+  g_free(load);
+}
+
+static void on_secrets_loaded(GObject *source, GAsyncResult *result,
+                              gpointer user_data) {
+  envchain_fetch_search *search = user_data;
+  envchain_fetch *fetch = search->fetch;
+  GError *error = NULL;
+  (void)source;
+
+  /*
+   * Items whose secret could not be decoded by the batch GetSecrets call are
+   * left without a cached value; load those one by one, concurrently.
+   */
+  if (!secret_item_load_secrets_finish(result, &error)) {
+    g_clear_error(&error);
   }
 
-  if (secret_collection_get_locked(collection)) {
-    GList *objects = g_list_append(NULL, collection);
-    GList *unlocked = NULL;
-    const gint n =
-        secret_service_unlock_sync(secret_collection_get_service(collection),
-                                   objects, NULL, &unlocked, error);
-    g_list_free(objects);
-    g_list_free(unlocked);
-    g_object_unref(collection);
-    if (*error != NULL) {
-      return NULL;
+  GList *iter;
+  for (iter = search->items; iter != NULL; iter = iter->next) {
+    SecretItem *item = iter->data;
+    SecretValue *value = secret_item_get_secret(item);
+    if (value != NULL) {
+      g_hash_table_insert(fetch->values, item, value);
+      continue;
     }
+    envchain_fetch_load *load = g_new0(envchain_fetch_load, 1);
+    load->fetch = fetch;
+    load->item = item;
+    fetch->loading++;
+    fetch->pending++;
+    envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1);
+    secret_item_load_secret(item, NULL, on_secret_loaded, load);
+  }
+
+  if (--fetch->loading == 0) {
+    envchain_trace_end(ENVCHAIN_TRACE_LOAD, fetch->load_begin);
+  }
+  fetch->pending--;
+}
+
+static void load_search_secrets(envchain_fetch_search *search) {
+  envchain_fetch *fetch = search->fetch;
+
+  if (!fetch->load_secrets || search->items == NULL) {
+    return;
+  }
+  if (fetch->loading++ == 0) {
+    fetch->load_begin = envchain_trace_begin();
+  }
+  fetch->pending++;
+  envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1);
+  secret_item_load_secrets(search->items, NULL, on_secrets_loaded, search);
+}
+
+static void on_unlocked(GObject *source, GAsyncResult *result,
+                        gpointer user_data) {
+  envchain_fetch *fetch = user_data;
+  GError *error = NULL;
+
+  const gint n = secret_service_unlock_finish((SecretService *)source, result,
+                                              NULL, &error);
+  envchain_trace_end(ENVCHAIN_TRACE_UNLOCK, fetch->unlock_begin);
+  if (error != NULL) {
+    report_error(fetch, "secret_service_unlock", error);
+  } else {
     if (n == 0) {
       fprintf(stderr, "%s: failed to unlock collection\n", envchain_name);
     }
+    for (int i = 0; i < fetch->searches_count; ++i) {
+      if (fetch->searches[i].waiting_unlock) {
+        load_search_secrets(&fetch->searches[i]);
+      }
+    }
+  }
+  fetch->pending--;
+}
 
-    /* reload */
-    secret_service_disconnect();
-    service =
-        secret_service_get_sync(SECRET_SERVICE_LOAD_COLLECTIONS, NULL, error);
-    if (*error != NULL) {
-      return NULL;
+static void on_search_done(GObject *source, GAsyncResult *result,
+                           gpointer user_data) {
+  envchain_fetch_search *search = user_data;
+  envchain_fetch *fetch = search->fetch;
+  GError *error = NULL;
+
+  GList *items = secret_collection_search_finish((SecretCollection *)source,
+                                                 result, &error);
+  envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1 + g_list_length(items));
+  if (error != NULL) {
+    report_error(fetch, "secret_collection_search", error);
+  }
+
+  /* Keys beyond the single one the service matched are filtered here */
+  GList *iter;
+  gboolean locked = FALSE;
+  for (iter = items; iter != NULL; iter = iter->next) {
+    SecretItem *item = iter->data;
+    gboolean match = TRUE;
+    if (search->selector != NULL) {
+      GHashTable *attrs = secret_item_get_attributes(item);
+      match = envchain_selector_has_key(search->selector,
+                                        g_hash_table_lookup(attrs, "key"));
+      g_hash_table_unref(attrs);
+    }
+    if (!match) {
+      g_object_unref(item);
+      continue;
     }
-    collection = secret_collection_for_alias_sync(
-        service, SECRET_COLLECTION_DEFAULT, SECRET_COLLECTION_LOAD_ITEMS, NULL,
-        error);
-    g_object_unref(service);
-    if (*error != NULL) {
-      return NULL;
+    search->items = g_list_prepend(search->items, item);
+    /* Listing reads attributes only, which a locked item still exposes */
+    if (fetch->load_secrets && secret_item_get_locked(item)) {
+      fetch->locked = g_list_prepend(fetch->locked, item);
+      locked = TRUE;
     }
   }
+  g_list_free(items);
+  search->items = g_list_reverse(search->items);
 
-  GHashTable *attributes =
-      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-  if (name != NULL) {
-    g_hash_table_insert(attributes, g_strdup("name"), g_strdup(name));
+  /* Unlock (prompting if needed) once, for the locked items of all searches */
+  if (locked) {
+    search->waiting_unlock = TRUE;
+  } else {
+    load_search_secrets(search);
+  }
+  if (--fetch->searching == 0) {
+    envchain_trace_end(ENVCHAIN_TRACE_SEARCH, fetch->search_begin);
+    if (fetch->locked != NULL && fetch->result == 0) {
+      fetch->unlock_begin = envchain_trace_begin();
+      fetch->pending++;
+      envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1);
+      secret_service_unlock(fetch->service, fetch->locked, NULL, on_unlocked,
+                            fetch);
+    }
   }
-  GList *items =
-      secret_collection_search_sync(collection, envchain_get_schema(),
-                                    attributes, SECRET_SEARCH_ALL, NULL, error);
+  fetch->pending--;
+}
 
-  g_hash_table_unref(attributes);
-  g_object_unref(collection);
+static void on_collection_ready(GObject *source, GAsyncResult *result,
+                                gpointer user_data) {
+  envchain_fetch *fetch = user_data;
+  GError *error = NULL;
+  (void)source;
 
-  return items;
+  /* Resolve the alias only; items of the collection are not loaded here */
+  fetch->collection = secret_collection_for_alias_finish(result, &error);
+  envchain_trace_end(ENVCHAIN_TRACE_CONNECT, fetch->connect_begin);
+  envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 3);
+  if (error != NULL) {
+    report_error(fetch, "secret_collection_for_alias", error);
+  }
+  if (fetch->collection == NULL) {
+    // Default collection does not exist
+    fetch->pending--;
+    return;
+  }
+
+  /* SearchItems is evaluated by the service, so only envchain items get a proxy */
+  fetch->search_begin = envchain_trace_begin();
+  for (int i = 0; i < fetch->searches_count; ++i) {
+    envchain_fetch_search *search = &fetch->searches[i];
+    const envchain_selector *selector = search->selector;
+    GHashTable *attributes =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    if (selector != NULL) {
+      g_hash_table_insert(attributes, g_strdup("name"),
+                          g_strdup(selector->name));
+      if (selector->keys_count == 1) {
+        g_hash_table_insert(attributes, g_strdup("key"),
+                            g_strdup(selector->keys[0]));
+      }
+    }
+    fetch->searching++;
+    fetch->pending++;
+    secret_collection_search(fetch->collection, envchain_get_schema(),
+                             attributes, SECRET_SEARCH_ALL, NULL,
+                             on_search_done, search);
+    g_hash_table_unref(attributes);
+  }
+  fetch->pending--;
 }
 
-int envchain_search_namespaces(envchain_namespace_search_callback callback,
-                               void *data) {
+static void on_service_ready(GObject *source, GAsyncResult *result,
+                             gpointer user_data) {
+  envchain_fetch *fetch = user_data;
   GError *error = NULL;
+  (void)source;
 
-  GList *items = search_unlocked_collection(NULL, &error);
+  fetch->service = secret_service_get_finish(result, &error);
   if (error != NULL) {
-    fprintf(stderr, "%s: search_unlocked_collection failed with %d: %s\n",
-            envchain_name, error->code, error->message);
-    g_error_free(error);
+    report_error(fetch, "secret_service_get", error);
+    fetch->pending--;
+    return;
+  }
+  secret_collection_for_alias(fetch->service, SECRET_COLLECTION_DEFAULT,
+                              SECRET_COLLECTION_NONE, NULL,
+                              on_collection_ready, fetch);
+}
+
+// Runs the searches (and secret loads) of fetch until all have completed.
+static void run_fetch(envchain_fetch *fetch) {
+  GMainContext *main_context = g_main_context_new();
+  g_main_context_push_thread_default(main_context);
+
+  fetch->connect_begin = envchain_trace_begin();
+  fetch->pending = 1;
+  secret_service_get(SECRET_SERVICE_NONE, NULL, on_service_ready, fetch);
+  while (0 < fetch->pending) {
+    g_main_context_iteration(main_context, TRUE);
+  }
+
+  g_main_context_pop_thread_default(main_context);
+  g_main_context_unref(main_context);
+  fetch->failed = g_list_reverse(fetch->failed);
+}
+
+static void free_fetch(envchain_fetch *fetch) {
+  for (int i = 0; i < fetch->searches_count; ++i) {
+    g_list_free_full(fetch->searches[i].items, g_object_unref);
+  }
+  g_free(fetch->searches);
+  g_list_free(fetch->locked);
+  g_list_free(fetch->failed);
+  if (fetch->values != NULL) {
+    g_hash_table_unref(fetch->values);
+  }
+  if (fetch->collection != NULL) {
+    g_object_unref(fetch->collection);
+  }
+  if (fetch->service != NULL) {
+    g_object_unref(fetch->service);
+  }
+}
+
+static int search_namespaces(envchain_namespace_search_callback callback,
+                             void *data) {
+  envchain_fetch fetch = {0};
+  fetch.searches = g_new0(envchain_fetch_search, 1);
+  fetch.searches[0].fetch = &fetch;
+  fetch.searches_count = 1;
+  run_fetch(&fetch);
+  if (fetch.result != 0) {
+    free_fetch(&fetch);
     return 1;
   }
 
   GList *iter;
   GHashTable *names =
       g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-  for (iter = items; iter != NULL; iter = iter->next) {
+  for (iter = fetch.searches[0].items; iter != NULL; iter = iter->next) {
     SecretItem *item = iter->data;
     GHashTable *attrs = secret_item_get_attributes(item);
     char *name = g_strdup(g_hash_table_lookup(attrs, "name"));
@@ -108,100 +354,627 @@ int envchain_search_namespaces(envchain_namespace_search_callback callback,
   }
 
   g_hash_table_unref(names);
-  g_list_free(items);
+  free_fetch(&fetch);
+  return 0;
+}
+
+static int search_keys(envchain_key_search_callback callback, void *data) {
+  envchain_fetch fetch = {0};
+  fetch.searches = g_new0(envchain_fetch_search, 1);
+  fetch.searches[0].fetch = &fetch;
+  fetch.searches_count = 1;
+  run_fetch(&fetch);
+  if (fetch.result != 0) {
+    free_fetch(&fetch);
+    return 1;
+  }
+
+  /* attributes come with the item proxies; secrets are not loaded */
+  GList *iter;
+  for (iter = fetch.searches[0].items; iter != NULL; iter = iter->next) {
+    GHashTable *attrs = secret_item_get_attributes(iter->data);
+    const char *name = g_hash_table_lookup(attrs, "name");
+    const char *key = g_hash_table_lookup(attrs, "key");
+    if (name != NULL && key != NULL) {
+      callback(name, key, data);
+    }
+    g_hash_table_unref(attrs);
+  }
+
+  free_fetch(&fetch);
   return 0;
 }
 
-// Returns FALSE if the error is retryable
-static gboolean try_search_items(const char *name,
-                                 envchain_search_callback callback, void *data,
+static int retry_setting(const char *env_name, int fallback) {
+  const char *str = getenv(env_name);
+  if (str == NULL || *str == '\0') {
+    return fallback;
+  }
+  char *end;
+  long v = strtol(str, &end, 10);
+  if (*end != '\0' || v < 0 || ENVCHAIN_MAX_RETRY_SETTING < v) {
+    fprintf(stderr, "%s: ignoring invalid %s=%s\n", envchain_name, env_name,
+            str);
+    return fallback;
+  }
+  return (int)v;
+}
+
+static void report_load_error(GError *error) {
+  fprintf(stderr, "%s: secret_item_load_secret_sync failed with %d: %s\n",
+          envchain_name, error->code, error->message);
+}
+
+// Loads the secrets of failed items again through new proxies on a fresh
+// session. Returns the items that failed again with a retryable error.
+static GList *retry_item_secrets(GList *failed, GHashTable *values,
                                  int *result) {
   GError *error = NULL;
-  GList *items = search_unlocked_collection(name, &error);
+  GList *still_failed = NULL;
+
+  uint64_t trace_begin = envchain_trace_begin();
+  /* drop the shared service, so that a new session is negotiated */
+  secret_service_disconnect();
+  SecretService *service =
+      secret_service_get_sync(SECRET_SERVICE_OPEN_SESSION, NULL, &error);
+  envchain_trace_end(ENVCHAIN_TRACE_CONNECT, trace_begin);
+  envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 2);
   if (error != NULL) {
-    fprintf(stderr, "%s: search_unlocked_collection failed with %d: %s\n",
+    fprintf(stderr, "%s: secret_service_get_sync failed with %d: %s\n",
             envchain_name, error->code, error->message);
     g_error_free(error);
     *result = 1;
-    return TRUE;
+    return NULL;
   }
 
+  trace_begin = envchain_trace_begin();
   GList *iter;
-  for (iter = items; iter != NULL; iter = iter->next) {
+  for (iter = failed; iter != NULL && *result == 0; iter = iter->next) {
     SecretItem *item = iter->data;
-    GHashTable *attrs = secret_item_get_attributes(item);
-    char *key = g_hash_table_lookup(attrs, "key");
-    if (!secret_item_load_secret_sync(item, NULL, &error)) {
-      const int error_code = error->code;
-      g_error_free(error);
-      g_list_free(items);
-      if (error_code == SECRET_ERROR_PROTOCOL) {
-        return FALSE;
+    const char *path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(item));
+    SecretItem *fresh = secret_item_new_for_dbus_path_sync(
+        service, path, SECRET_ITEM_LOAD_SECRET, NULL, &error);
+    envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 2);
+    if (fresh != NULL) {
+      SecretValue *value = secret_item_get_secret(fresh);
+      if (value != NULL) {
+        g_hash_table_insert(values, item, value);
       } else {
-        fprintf(stderr, "%s: secret_item_load_secret_sync failed with %d: %s\n",
-                envchain_name, error->code, error->message);
-        *result = 1;
-        return TRUE;
+        still_failed = g_list_prepend(still_failed, item);
       }
+      g_object_unref(fresh);
+    } else if (error->code == SECRET_ERROR_PROTOCOL) {
+      still_failed = g_list_prepend(still_failed, item);
+      g_clear_error(&error);
+    } else {
+      report_load_error(error);
+      g_clear_error(&error);
+      *result = 1;
     }
-    SecretValue *value = secret_item_get_secret(item);
-    callback(key, secret_value_get_text(value), data);
-    secret_value_unref(value);
-    g_hash_table_unref(attrs);
   }
+  envchain_trace_end(ENVCHAIN_TRACE_LOAD, trace_begin);
 
-  g_list_free(items);
-  *result = 0;
-  return TRUE;
+  g_object_unref(service);
+  return g_list_reverse(still_failed);
 }
 
-int envchain_search_values(const char *name, envchain_search_callback callback,
-                           void *data) {
+static int search_values_multi(const envchain_selector *selectors,
+                               int selectors_count,
+                               envchain_search_callback callback, void *data) {
   /*
-   * Retry when org.freedesktop.Secret.Item.GetSecret (secret_item_load_secret_sync)
-   * fails. It occasionally fails with a message "** Message: received an
-   * invalid or unencryptable secret".
+   * Secrets are collected before any callback fires, so that each item is
+   * passed exactly once. GetSecret occasionally fails with "received an
+   * invalid or unencryptable secret"; only the items that failed that way
+   * are retried, on a fresh session after an exponential backoff.
    */
-  for (int retry_count = 0; retry_count < 3; ++retry_count) {
-    int result = -1;
-    if (try_search_items(name, callback, data, &result)) {
-      return result;
+  envchain_fetch fetch = {0};
+  fetch.searches = g_new0(envchain_fetch_search, selectors_count);
+  fetch.searches_count = selectors_count;
+  fetch.load_secrets = TRUE;
+  fetch.values = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                       secret_value_unref);
+  for (int i = 0; i < selectors_count; ++i) {
+    fetch.searches[i].fetch = &fetch;
+    fetch.searches[i].selector = &selectors[i];
+  }
+  run_fetch(&fetch);
+
+  int result = fetch.result;
+  GList *failed = fetch.failed;
+  fetch.failed = NULL;
+
+  const int attempts =
+      retry_setting("ENVCHAIN_RETRY_ATTEMPTS", ENVCHAIN_DEFAULT_RETRY_ATTEMPTS);
+  const int backoff_ms = retry_setting("ENVCHAIN_RETRY_BACKOFF_MS",
+                                       ENVCHAIN_DEFAULT_RETRY_BACKOFF_MS);
+  for (int attempt = 0; failed != NULL && result == 0 && attempt < attempts;
+       ++attempt) {
+    g_usleep((gulong)backoff_ms * 1000 * (1 << MIN(attempt, 4)));
+    envchain_trace_count(ENVCHAIN_TRACE_RETRIES, g_list_length(failed));
+    GList *retried = retry_item_secrets(failed, fetch.values, &result);
+    g_list_free(failed);
+    failed = retried;
+  }
+  if (failed != NULL && result == 0) {
+    fprintf(stderr, "%s: too many secret_item_load_secret_sync failures\n",
+            envchain_name);
+    result = 1;
+  }
+  g_list_free(failed);
+
+  if (result == 0) {
+    /* Later selectors are passed last so that they take precedence */
+    for (int i = 0; i < selectors_count; ++i) {
+      GList *iter;
+      for (iter = fetch.searches[i].items; iter != NULL; iter = iter->next) {
+        SecretItem *item = iter->data;
+        SecretValue *value = g_hash_table_lookup(fetch.values, item);
+        if (value == NULL) {
+          continue;
+        }
+        GHashTable *attrs = secret_item_get_attributes(item);
+        gsize length = 0;
+        const gchar *bytes = secret_value_get(value, &length);
+        envchain_trace_count(ENVCHAIN_TRACE_ITEMS, 1);
+        envchain_trace_count(ENVCHAIN_TRACE_BYTES, length);
+        callback(g_hash_table_lookup(attrs, "key"), bytes, length, data);
+        g_hash_table_unref(attrs);
+      }
     }
-    secret_service_disconnect();
   }
-  fprintf(stderr, "%s: too many secret_item_load_secret_sync failures\n",
-          envchain_name);
-  return 1;
+
+  free_fetch(&fetch);
+  return result;
 }
 
-void envchain_save_value(const char *name, const char *key, char *value,
-                         int require_passphrase) {
+typedef struct {
+  int pending;
+  GPtrArray *failures;
+} envchain_store_context;
+
+typedef struct {
+  envchain_store_context *context;
+  char *key;
+} envchain_store_request;
+
+static void on_value_stored(GObject *source, GAsyncResult *result,
+                            gpointer user_data) {
+  envchain_store_request *request = user_data;
+  GError *error = NULL;
+
+  if (!secret_service_store_finish((SecretService *)source, result, &error)) {
+    g_ptr_array_add(request->context->failures,
+                    g_strdup_printf("%s: failed to store %s: %s (%d)",
+                                    envchain_name, request->key,
+                                    error->message, error->code));
+    g_error_free(error);
+  }
+  request->context->pending--;
+  g_free(request->key);
+  g_free(request);
+}
+
+static int save_values(const char *name, const char **keys,
+                       const char **values, const size_t *value_lens,
+                       int count, int require_passphrase) {
   if (require_passphrase == 1) {
     fprintf(
         stderr,
         "%s: Sorry, `--require-passphrase' is unsupported on this platform\n",
         envchain_name);
-    return;
+    return count;
   }
 
   GError *error = NULL;
-  secret_password_store_sync(envchain_get_schema(), SECRET_COLLECTION_DEFAULT,
-                             key, value, NULL, &error, "name", name, "key", key,
-                             NULL);
+  SecretService *service =
+      secret_service_get_sync(SECRET_SERVICE_OPEN_SESSION, NULL, &error);
   if (error != NULL) {
-    fprintf(stderr, "%s: secret_password_store_sync failed with %d: %s\n",
+    fprintf(stderr, "%s: secret_service_get_sync failed with %d: %s\n",
             envchain_name, error->code, error->message);
     g_error_free(error);
+    return count;
+  }
+
+  /*
+   * Issue the CreateItem calls asynchronously on the one service connection,
+   * keeping at most ENVCHAIN_MAX_PENDING_STORES of them in flight.
+   */
+  GMainContext *main_context = g_main_context_new();
+  g_main_context_push_thread_default(main_context);
+
+  uint64_t trace_begin = envchain_trace_begin();
+  envchain_store_context context = {0, g_ptr_array_new_with_free_func(g_free)};
+  int next = 0;
+  while (next < count || 0 < context.pending) {
+    while (next < count && context.pending < ENVCHAIN_MAX_PENDING_STORES) {
+      envchain_store_request *request = g_new0(envchain_store_request, 1);
+      request->context = &context;
+      request->key = g_strdup(keys[next]);
+
+      GHashTable *attributes =
+          g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+      g_hash_table_insert(attributes, g_strdup("name"), g_strdup(name));
+      g_hash_table_insert(attributes, g_strdup("key"), g_strdup(keys[next]));
+      /* keep text/plain for text, so other Secret Service clients show it */
+      const char *content_type =
+          memchr(values[next], '\0', value_lens[next]) != NULL
+              ? "application/octet-stream"
+              : "text/plain";
+      SecretValue *value =
+          secret_value_new(values[next], value_lens[next], content_type);
+
+      secret_service_store(service, envchain_get_schema(), attributes,
+                           SECRET_COLLECTION_DEFAULT, keys[next], value, NULL,
+                           on_value_stored, request);
+      secret_value_unref(value);
+      g_hash_table_unref(attributes);
+
+      context.pending++;
+      next++;
+    }
+    g_main_context_iteration(main_context, TRUE);
+  }
+  envchain_trace_end(ENVCHAIN_TRACE_STORE, trace_begin);
+  envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, count);
+
+  g_main_context_pop_thread_default(main_context);
+  g_main_context_unref(main_context);
+  g_object_unref(service);
+
+  const int failures = context.failures->len;
+  for (guint i = 0; i < context.failures->len; ++i) {
+    fprintf(stderr, "%s\n", (char *)context.failures->pdata[i]);
   }
+  g_ptr_array_unref(context.failures);
+  return failures;
 }
 
-void envchain_delete_value(const char *name, const char *key) {
+typedef struct {
+  const char *call;
+  gboolean (*finish)(SecretItem *item, GAsyncResult *result, GError **error);
+  const char *new_name; // NULL to delete
+  envchain_trace_phase phase;
+  int pending;
+  int failures;
+} envchain_update_context;
+
+static void on_item_updated(GObject *source, GAsyncResult *result,
+                            gpointer user_data) {
+  envchain_update_context *context = user_data;
   GError *error = NULL;
-  secret_password_clear_sync(envchain_get_schema(), NULL, &error,
-                             "name", name, "key", key, NULL);
+
+  if (!context->finish((SecretItem *)source, result, &error)) {
+    fprintf(stderr, "%s: %s failed with %d: %s\n", envchain_name,
+            context->call, error->code, error->message);
+    g_error_free(error);
+    context->failures++;
+  }
+  context->pending--;
+}
+
+static void start_item_update(SecretItem *item, const char *key,
+                              envchain_update_context *context) {
+  if (context->new_name == NULL) {
+    secret_item_delete(item, NULL, on_item_updated, context);
+    return;
+  }
+  /* SetAttributes leaves the secret as it is */
+  GHashTable *attributes =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_hash_table_insert(attributes, g_strdup("name"),
+                      g_strdup(context->new_name));
+  g_hash_table_insert(attributes, g_strdup("key"), g_strdup(key));
+  secret_item_set_attributes(item, envchain_get_schema(), attributes, NULL,
+                             on_item_updated, context);
+  g_hash_table_unref(attributes);
+}
+
+// Deletes or renames the items of name that match selects. The items come
+// from one search, and the calls for them are issued asynchronously, at most
+// ENVCHAIN_MAX_PENDING_STORES in flight as for stores.
+static int update_items(const char *name, envchain_key_match_callback match,
+                        void *data, envchain_update_context *context) {
+  envchain_selector selector = {name, NULL, 0};
+  envchain_fetch fetch = {0};
+  fetch.searches = g_new0(envchain_fetch_search, 1);
+  fetch.searches[0].fetch = &fetch;
+  fetch.searches[0].selector = name != NULL ? &selector : NULL;
+  fetch.searches_count = 1;
+  run_fetch(&fetch);
+  if (fetch.result != 0) {
+    free_fetch(&fetch);
+    return -1;
+  }
+
+  GMainContext *main_context = g_main_context_new();
+  g_main_context_push_thread_default(main_context);
+
+  uint64_t trace_begin = envchain_trace_begin();
+  GList *next = fetch.searches[0].items;
+  while (next != NULL || 0 < context->pending) {
+    while (next != NULL && context->pending < ENVCHAIN_MAX_PENDING_STORES) {
+      SecretItem *item = next->data;
+      next = next->next;
+
+      GHashTable *attrs = secret_item_get_attributes(item);
+      const char *item_name = g_hash_table_lookup(attrs, "name");
+      const char *item_key = g_hash_table_lookup(attrs, "key");
+      if (item_name != NULL && item_key != NULL &&
+          match(item_name, item_key, data)) {
+        context->pending++;
+        envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1);
+        start_item_update(item, item_key, context);
+      }
+      g_hash_table_unref(attrs);
+    }
+    if (0 < context->pending) {
+      g_main_context_iteration(main_context, TRUE);
+    }
+  }
+  envchain_trace_end(context->phase, trace_begin);
+
+  g_main_context_pop_thread_default(main_context);
+  g_main_context_unref(main_context);
+  free_fetch(&fetch);
+  return context->failures;
+}
+
+static int delete_values(const char *name, envchain_key_match_callback match,
+                         void *data) {
+  envchain_update_context context = {
+      "secret_item_delete", secret_item_delete_finish, NULL,
+      ENVCHAIN_TRACE_DELETE, 0, 0};
+  return update_items(name, match, data, &context);
+}
+
+static int rename_values(const char *name, const char *new_name,
+                         envchain_key_match_callback match, void *data) {
+  envchain_update_context context = {
+      "secret_item_set_attributes", secret_item_set_attributes_finish,
+      new_name, ENVCHAIN_TRACE_STORE, 0, 0};
+  return update_items(name, match, data, &context);
+}
+
+/*
+ * The ItemCreated/ItemChanged/ItemDeleted signals of the collections are
+ * subscribed to once, on a context of their own, so that signals arriving
+ * while the caller is busy are queued until its next call. A deleted item has
+ * no attributes left to look at, so the paths of the watched items are
+ * remembered from a search when watching starts and updated as signals come.
+ */
+typedef struct {
+  char *name;
+  char *key;
+} envchain_watch_item;
+
+typedef struct {
+  GMainContext *context;
+  GDBusConnection *connection;
+  GHashTable *items; // object path -> envchain_watch_item
+  const envchain_selector *selectors;
+  int selectors_count;
+  envchain_watch_callback callback;
+  void *data;
+  int changes;
+  int pending; // Properties.Get calls in flight
+} envchain_watch_state;
+
+static envchain_watch_state watch_state;
+
+static void free_watch_item(gpointer data) {
+  envchain_watch_item *item = data;
+  g_free(item->name);
+  g_free(item->key);
+  g_free(item);
+}
+
+static gboolean watch_selected(const char *name, const char *key) {
+  for (int i = 0; i < watch_state.selectors_count; ++i) {
+    if (strcmp(watch_state.selectors[i].name, name) == 0 &&
+        envchain_selector_has_key(&watch_state.selectors[i], key)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static void report_watch_item(const envchain_watch_item *item) {
+  watch_state.changes++;
+  watch_state.callback(item->name, item->key, watch_state.data);
+}
+
+static void on_watch_attributes(GObject *source, GAsyncResult *result,
+                                gpointer user_data) {
+  char *path = user_data;
+  GError *error = NULL;
+  const char *schema = NULL, *name = NULL, *key = NULL;
+
+  watch_state.pending--;
+  /* an item deleted right after the signal is handled like ItemDeleted */
+  GVariant *reply = g_dbus_connection_call_finish((GDBusConnection *)source,
+                                                  result, &error);
+  GVariant *attributes = NULL;
+  if (reply != NULL) {
+    g_variant_get(reply, "(v)", &attributes);
+    g_variant_lookup(attributes, "xdg:schema", "&s", &schema);
+    g_variant_lookup(attributes, "name", "&s", &name);
+    g_variant_lookup(attributes, "key", "&s", &key);
+  } else {
+    g_error_free(error);
+  }
+
+  envchain_watch_item *old = g_hash_table_lookup(watch_state.items, path);
+  if (name != NULL && key != NULL &&
+      g_strcmp0(schema, envchain_get_schema()->name) == 0 &&
+      watch_selected(name, key)) {
+    envchain_watch_item *item = g_new0(envchain_watch_item, 1);
+    item->name = g_strdup(name);
+    item->key = g_strdup(key);
+    /* an item moved to another name or key changes both */
+    if (old != NULL &&
+        (strcmp(old->name, name) != 0 || strcmp(old->key, key) != 0)) {
+      report_watch_item(old);
+    }
+    report_watch_item(item);
+    g_hash_table_replace(watch_state.items, path, item);
+    path = NULL;
+  } else if (old != NULL) {
+    report_watch_item(old);
+    g_hash_table_remove(watch_state.items, path);
+  }
+
+  if (attributes != NULL) {
+    g_variant_unref(attributes);
+  }
+  if (reply != NULL) {
+    g_variant_unref(reply);
+  }
+  g_free(path);
+}
+
+static void on_watch_signal(GDBusConnection *connection, const gchar *sender,
+                            const gchar *object_path,
+                            const gchar *interface_name,
+                            const gchar *signal_name, GVariant *parameters,
+                            gpointer user_data) {
+  const gchar *path;
+  (void)sender;
+  (void)object_path;
+  (void)interface_name;
+  (void)user_data;
+
+  if (!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(o)"))) {
+    return;
+  }
+  g_variant_get(parameters, "(&o)", &path);
+
+  if (strcmp(signal_name, "ItemDeleted") == 0) {
+    envchain_watch_item *item = g_hash_table_lookup(watch_state.items, path);
+    if (item != NULL) {
+      report_watch_item(item);
+      g_hash_table_remove(watch_state.items, path);
+    }
+  } else if (strcmp(signal_name, "ItemCreated") == 0 ||
+             strcmp(signal_name, "ItemChanged") == 0) {
+    /* attributes are readable without unlocking, and no proxy is needed */
+    watch_state.pending++;
+    envchain_trace_count(ENVCHAIN_TRACE_DBUS_CALLS, 1);
+    g_dbus_connection_call(
+        connection, "org.freedesktop.secrets", path,
+        "org.freedesktop.DBus.Properties", "Get",
+        g_variant_new("(ss)", "org.freedesktop.Secret.Item", "Attributes"),
+        G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        on_watch_attributes, g_strdup(path));
+  }
+}
+
+static int start_watch(const envchain_selector *selectors,
+                       int selectors_count) {
+  GError *error = NULL;
+
+  watch_state.connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
   if (error != NULL) {
-    fprintf(stderr, "%s: secret_password_clear_sync failed with %d: %s\n",
-            envchain_name, error->code, error->message);
+    fprintf(stderr, "%s: g_bus_get_sync failed with %d: %s\n", envchain_name,
+            error->code, error->message);
     g_error_free(error);
+    return 1;
+  }
+  /* subscribe before searching, so that no change goes unnoticed */
+  watch_state.context = g_main_context_new();
+  g_main_context_push_thread_default(watch_state.context);
+  g_dbus_connection_signal_subscribe(
+      watch_state.connection, "org.freedesktop.secrets",
+      "org.freedesktop.Secret.Collection", NULL, NULL, NULL,
+      G_DBUS_SIGNAL_FLAGS_NONE, on_watch_signal, NULL, NULL);
+  g_main_context_pop_thread_default(watch_state.context);
+
+  envchain_fetch fetch = {0};
+  fetch.searches = g_new0(envchain_fetch_search, selectors_count);
+  fetch.searches_count = selectors_count;
+  for (int i = 0; i < selectors_count; ++i) {
+    fetch.searches[i].fetch = &fetch;
+    fetch.searches[i].selector = &selectors[i];
+  }
+  run_fetch(&fetch);
+
+  watch_state.items =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_watch_item);
+  for (int i = 0; i < fetch.searches_count; ++i) {
+    GList *iter;
+    for (iter = fetch.searches[i].items; iter != NULL; iter = iter->next) {
+      SecretItem *secret_item = iter->data;
+      GHashTable *attrs = secret_item_get_attributes(secret_item);
+      envchain_watch_item *item = g_new0(envchain_watch_item, 1);
+      item->name = g_strdup(g_hash_table_lookup(attrs, "name"));
+      item->key = g_strdup(g_hash_table_lookup(attrs, "key"));
+      g_hash_table_replace(
+          watch_state.items,
+          g_strdup(g_dbus_proxy_get_object_path(G_DBUS_PROXY(secret_item))),
+          item);
+      g_hash_table_unref(attrs);
+    }
+  }
+  int result = fetch.result;
+  free_fetch(&fetch);
+  return result;
+}
+
+static gboolean on_watch_flag(gpointer user_data) {
+  *(gboolean *)user_data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_watch_wake(gint fd, GIOCondition condition,
+                              gpointer user_data) {
+  (void)fd;
+  (void)condition;
+  return on_watch_flag(user_data);
+}
+
+static int watch(const envchain_selector *selectors, int selectors_count,
+                 int wake_fd, envchain_watch_callback callback, void *data) {
+  watch_state.selectors = selectors;
+  watch_state.selectors_count = selectors_count;
+  watch_state.callback = callback;
+  watch_state.data = data;
+  watch_state.changes = 0;
+  if (watch_state.context == NULL &&
+      start_watch(selectors, selectors_count) != 0) {
+    return 1;
+  }
+
+  gboolean woken = FALSE, settled = FALSE;
+  GSource *wake = g_unix_fd_source_new(wake_fd, G_IO_IN);
+  g_source_set_callback(wake, G_SOURCE_FUNC(on_watch_wake), &woken, NULL);
+  g_source_attach(wake, watch_state.context);
+
+  /* changes usually come in bursts, e.g. --set of several keys */
+  GSource *settle = NULL;
+  while (!woken && !(settled && watch_state.pending == 0)) {
+    g_main_context_iteration(watch_state.context, TRUE);
+    if (0 < watch_state.changes && settle == NULL) {
+      settle = g_timeout_source_new(ENVCHAIN_WATCH_SETTLE_MS);
+      g_source_set_callback(settle, on_watch_flag, &settled, NULL);
+      g_source_attach(settle, watch_state.context);
+    }
   }
+
+  if (settle != NULL) {
+    g_source_destroy(settle);
+    g_source_unref(settle);
+  }
+  g_source_destroy(wake);
+  g_source_unref(wake);
+  return 0;
 }
+
+const envchain_backend envchain_backend_secret_service = {
+    .name = "secret-service",
+    .search_namespaces = search_namespaces,
+    .search_keys = search_keys,
+    .search_values_multi = search_values_multi,
+    .save_values = save_values,
+    .delete_values = delete_values,
+    .rename_values = rename_values,
+    .watch = watch,
+};
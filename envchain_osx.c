@@ -136,7 +136,6 @@ envchain_search_values_applier(const void *raw_ref, void *raw_context)
   UInt32 len, keylen = 0;
   char* rawvalue = NULL;
   char* rawkey = NULL;
-  char* value = NULL;
   char* key = NULL;
 
   if (context->search_callback) {
@@ -186,11 +185,10 @@ envchain_search_values_applier(const void *raw_ref, void *raw_context)
   }
 
   if (context->search_callback) {
-    value = malloc(len+1);
-    if (value == NULL) goto fail;
-    memcpy(value,rawvalue,len);
-    value[len] = '\0';
-    context->search_callback(key, value, context->data);
+    /* the callback takes the length, so the keychain's buffer is passed as is */
+    envchain_trace_count(ENVCHAIN_TRACE_ITEMS, 1);
+    envchain_trace_count(ENVCHAIN_TRACE_BYTES, len);
+    context->search_callback(key, rawvalue, len, context->data);
   }
   else {
     context->namespace_callback(key, context->data);
@@ -201,15 +199,12 @@ fail:
   fprintf(stderr, "Something wrong during searching value\n");
   if (errno) fprintf(stderr, "errno: %s\n", strerror(errno));
 ensure:
-  if (value) {
-    memset(value, 0, len);
-    free(value);
-  }
   if (key) {
     memset(key, 0, keylen);
     free(key);
   }
   if (context->search_callback) {
+    if (rawvalue) memset(rawvalue, 0, len);
     SecKeychainItemFreeContent(&list, rawvalue);
   }
   return;
@@ -227,8 +222,8 @@ envchain_search_namespaces_uniqufier(const char* name, void *raw_context)
   context->head_index++;
 }
 
-int
-envchain_search_namespaces(envchain_namespace_search_callback callback, void *data)
+static int
+envchain_keychain_search_namespaces(envchain_namespace_search_callback callback, void *data)
 {
   OSStatus status;
   CFArrayRef items = NULL;
@@ -287,53 +282,194 @@ fail:
   return 0;
 }
 
-int
-envchain_search_values(const char *name, envchain_search_callback callback, void *data)
+static char*
+envchain_cfstring_copy_cstr(CFStringRef str)
+{
+  if (str == NULL || CFGetTypeID(str) != CFStringGetTypeID()) return NULL;
+
+  CFIndex size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(str), kCFStringEncodingUTF8) + 1;
+  char *cstr = malloc(size);
+  if (cstr != NULL && !CFStringGetCString(str, cstr, size, kCFStringEncodingUTF8)) {
+    free(cstr);
+    cstr = NULL;
+  }
+  return cstr;
+}
+
+typedef void (*envchain_keychain_item_func)(CFDictionaryRef attrs, const char *name, const char *key, void *data);
+
+/*
+ * Passes the attributes (and kSecValueRef) of every envchain item of
+ * namespace name, or of every namespace when name is NULL, to func. Reading
+ * attributes doesn't need access to the secrets.
+ */
+static int
+envchain_keychain_each_item(const char *name, envchain_keychain_item_func func, void *data)
+{
+  OSStatus status;
+  CFArrayRef items = NULL;
+  CFStringRef description = CFStringCreateWithCString(NULL, ENVCHAIN_ITEM_DESCRIPTION, kCFStringEncodingUTF8);
+  CFStringRef service_name = name ? envchain_generate_service_name_cf(name) : NULL;
+  size_t prefix_len = strlen(ENVCHAIN_SERVICE_PREFIX);
+
+  const void *query_keys[] = {
+    kSecClass, kSecAttrDescription,
+    kSecReturnAttributes, kSecReturnRef, kSecMatchLimit,
+    kSecAttrService
+  };
+  const void *query_vals[] = {
+    kSecClassGenericPassword, description,
+    kCFBooleanTrue, kCFBooleanTrue, kSecMatchLimitAll,
+    service_name
+  };
+  CFIndex query_count = sizeof(query_keys) / sizeof(query_keys[0]) - (service_name ? 0 : 1);
+
+  CFDictionaryRef query = CFDictionaryCreate(kCFAllocatorDefault,
+      query_keys, query_vals, query_count,
+      &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+  uint64_t trace_begin = envchain_trace_begin();
+  status = SecItemCopyMatching(query, (CFTypeRef *)&items);
+  envchain_trace_end(ENVCHAIN_TRACE_SEARCH, trace_begin);
+  if (status != errSecItemNotFound && status != noErr) goto fail;
+  if (status == errSecItemNotFound) {
+    status = noErr;
+    goto fail;
+  }
+
+  for (CFIndex i = 0; i < CFArrayGetCount(items); i++) {
+    CFDictionaryRef attrs = CFArrayGetValueAtIndex(items, i);
+    char *service = envchain_cfstring_copy_cstr(CFDictionaryGetValue(attrs, kSecAttrService));
+    char *account = envchain_cfstring_copy_cstr(CFDictionaryGetValue(attrs, kSecAttrAccount));
+
+    if (service != NULL && account != NULL &&
+        strncmp(service, ENVCHAIN_SERVICE_PREFIX, prefix_len) == 0) {
+      func(attrs, service + prefix_len, account, data);
+    }
+    free(service);
+    free(account);
+  }
+
+fail:
+  if (items != NULL) CFRelease(items);
+  if (query != NULL) CFRelease(query);
+  if (service_name != NULL) CFRelease(service_name);
+  if (description != NULL) CFRelease(description);
+  if (status != noErr) envchain_fail_osstatus(status);
+
+  return 0;
+}
+
+typedef struct {
+  envchain_key_search_callback callback;
+  void *data;
+} envchain_keychain_search_keys_context;
+
+static void
+envchain_keychain_search_keys_applier(CFDictionaryRef attrs, const char *name, const char *key, void *raw_context)
+{
+  envchain_keychain_search_keys_context *context = raw_context;
+  (void)attrs;
+  context->callback(name, key, context->data);
+}
+
+static int
+envchain_keychain_search_keys(envchain_key_search_callback callback, void *data)
+{
+  envchain_keychain_search_keys_context context = {callback, data};
+  return envchain_keychain_each_item(NULL, &envchain_keychain_search_keys_applier, &context);
+}
+
+/* key may be NULL to search every item of the namespace */
+static int
+envchain_search_values_query(const char *name, const char *key, envchain_search_callback callback, void *data)
 {
   OSStatus status;
   CFStringRef service_name = envchain_generate_service_name_cf(name);
+  CFStringRef account = NULL;
   CFArrayRef items = NULL;
 
   const void *query_keys[] = {
     kSecClass, kSecAttrService,
-    kSecReturnRef, kSecMatchLimit
+    kSecReturnRef, kSecMatchLimit,
+    kSecAttrAccount
   };
   const void *query_vals[] = {
     kSecClassGenericPassword, service_name,
-    kCFBooleanTrue, kSecMatchLimitAll
+    kCFBooleanTrue, kSecMatchLimitAll,
+    NULL
   };
+  CFIndex query_count = sizeof(query_keys) / sizeof(query_keys[0]) - 1;
+
+  if (key != NULL) {
+    account = CFStringCreateWithCString(NULL, key, kCFStringEncodingUTF8);
+    query_vals[query_count++] = account;
+  }
 
   CFDictionaryRef query = CFDictionaryCreate(kCFAllocatorDefault,
-      query_keys, query_vals, sizeof(query_keys) / sizeof(query_keys[0]),
+      query_keys, query_vals, query_count,
       &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
 
+  uint64_t trace_begin = envchain_trace_begin();
   status = SecItemCopyMatching(query, (CFTypeRef *)&items);
+  envchain_trace_end(ENVCHAIN_TRACE_SEARCH, trace_begin);
   if (status != errSecItemNotFound && status != noErr) goto fail;
 
   if (status == errSecItemNotFound || CFArrayGetCount(items) == 0) {
-    fprintf(stderr,
-      "WARNING: namespace `%s` not defined.\n"
-      "         You can set via running `%s --set %s SOME_ENV_NAME`.\n\n",
-      name, envchain_name, name
-    );
+    if (key == NULL) {
+      fprintf(stderr,
+        "WARNING: namespace `%s` not defined.\n"
+        "         You can set via running `%s --set %s SOME_ENV_NAME`.\n\n",
+        name, envchain_name, name
+      );
+    }
+    if (account != NULL) CFRelease(account);
     return 1;
   }
   
   envchain_search_values_applier_data context = {callback, NULL, data};
+  trace_begin = envchain_trace_begin();
   CFArrayApplyFunction(
     items, CFRangeMake(0, CFArrayGetCount(items)),
     &envchain_search_values_applier, &context
   );
+  envchain_trace_end(ENVCHAIN_TRACE_LOAD, trace_begin);
 
 fail:
   if (items != NULL) CFRelease(items);
   if (query != NULL) CFRelease(query);
   if (service_name != NULL) CFRelease(service_name);
+  if (account != NULL) CFRelease(account);
   if (status != noErr) envchain_fail_osstatus(status);
 
   return 0;
 }
 
+static int
+envchain_keychain_search_values(const char *name, envchain_search_callback callback, void *data)
+{
+  return envchain_search_values_query(name, NULL, callback, data);
+}
+
+static int
+envchain_keychain_search_values_multi(const envchain_selector *selectors, int selectors_count, envchain_search_callback callback, void *data)
+{
+  int result = 0;
+
+  for (int i = 0; i < selectors_count; i++) {
+    if (selectors[i].keys == NULL) {
+      if (envchain_keychain_search_values(selectors[i].name, callback, data) != 0) result = 1;
+      continue;
+    }
+    /* look selected keys up by account, so other items are never decrypted */
+    for (int j = 0; j < selectors[i].keys_count; j++) {
+      if (envchain_search_values_query(selectors[i].name, selectors[i].keys[j], callback, data) != 0) result = 1;
+    }
+  }
+
+  return result;
+}
+
 static int
 envchain_find_value(const char *name, const char *key, SecKeychainItemRef *ref)
 {
@@ -358,11 +494,14 @@ envchain_find_value(const char *name, const char *key, SecKeychainItemRef *ref)
   return status == errSecItemNotFound ? 0 : 1;
 }
 
-void
-envchain_save_value(const char *name, const char *key, char *value, int require_passphrase)
+/* Returns non-zero on failure */
+static int
+envchain_keychain_save_value(const char *name, const char *key, const char *value, size_t value_len,
+                             int require_passphrase)
 {
   char *service_name = envchain_generate_service_name(name);
   OSStatus status;
+  int failed = 0;
   SecKeychainItemRef ref = NULL;
   SecAccessRef access_ref = NULL;
   CFArrayRef acl_list = nil;
@@ -372,7 +511,7 @@ envchain_save_value(const char *name, const char *key, char *value, int require_
       envchain_keychain,
       strlen(service_name), service_name,
       strlen(key), key,
-      strlen(value), value,
+      value_len, value,
       &ref
     );
   }
@@ -380,7 +519,7 @@ envchain_save_value(const char *name, const char *key, char *value, int require_
     status = SecKeychainItemModifyAttributesAndData(
       ref,
       NULL,
-      strlen(value), value
+      value_len, value
     );
   }
 
@@ -395,7 +534,7 @@ envchain_save_value(const char *name, const char *key, char *value, int require_
   status = SecKeychainItemModifyAttributesAndData(
     ref,
     &attrs,
-    strlen(value), value
+    value_len, value
   );
 
   if (status != noErr) goto fail;
@@ -414,6 +553,7 @@ envchain_save_value(const char *name, const char *key, char *value, int require_
 
     if (acl == NULL) {
       fprintf(stderr, "error: There's no ACL?\n");
+      failed = 1;
       goto passfail;
     }
 
@@ -449,13 +589,102 @@ fail:
   if (acl_list != NULL) { CFRelease(acl_list); }
   if (status != noErr) envchain_fail_osstatus(status);
 
-  return;
+  return failed || status != noErr;
 }
 
-void
-envchain_delete_value(const char *name, const char *key) {
-  SecKeychainItemRef ref = NULL;
-  if (envchain_find_value(name, key, &ref) != 0) {
-    SecKeychainItemDelete(ref);
+static int
+envchain_keychain_save_values(const char *name, const char **keys, const char **values,
+                              const size_t *value_lens, int count, int require_passphrase)
+{
+  int failures = 0;
+
+  for (int i = 0; i < count; i++) {
+    failures += envchain_keychain_save_value(name, keys[i], values[i], value_lens[i], require_passphrase);
+  }
+  return failures;
+}
+
+typedef struct {
+  envchain_key_match_callback match;
+  void *data;
+  int failures;
+} envchain_keychain_delete_values_context;
+
+static void
+envchain_keychain_delete_values_applier(CFDictionaryRef attrs, const char *name, const char *key, void *raw_context)
+{
+  envchain_keychain_delete_values_context *context = raw_context;
+  SecKeychainItemRef ref = (SecKeychainItemRef)CFDictionaryGetValue(attrs, kSecValueRef);
+
+  if (ref == NULL || !context->match(name, key, context->data)) return;
+  OSStatus status = SecKeychainItemDelete(ref);
+  if (status != noErr) {
+    fprintf(stderr, "%s: failed to delete %s.%s (%d)\n", envchain_name, name, key, (int)status);
+    context->failures++;
+  }
+}
+
+/* the matching items are found by one query, and deleted through its refs */
+static int
+envchain_keychain_delete_values(const char *name, envchain_key_match_callback match, void *data)
+{
+  envchain_keychain_delete_values_context context = {match, data, 0};
+
+  uint64_t trace_begin = envchain_trace_begin();
+  envchain_keychain_each_item(name, &envchain_keychain_delete_values_applier, &context);
+  envchain_trace_end(ENVCHAIN_TRACE_DELETE, trace_begin);
+  return context.failures;
+}
+
+typedef struct {
+  envchain_key_match_callback match;
+  void *data;
+  const char *service_name;
+  int failures;
+} envchain_keychain_rename_values_context;
+
+static void
+envchain_keychain_rename_values_applier(CFDictionaryRef attrs, const char *name, const char *key, void *raw_context)
+{
+  envchain_keychain_rename_values_context *context = raw_context;
+  SecKeychainItemRef ref = (SecKeychainItemRef)CFDictionaryGetValue(attrs, kSecValueRef);
+
+  if (ref == NULL || !context->match(name, key, context->data)) return;
+
+  /* the service and the label (which defaults to it); the data is left untouched */
+  SecKeychainAttribute attr_list[] = {
+    {kSecServiceItemAttr, strlen(context->service_name), (void*)context->service_name},
+    {kSecLabelItemAttr, strlen(context->service_name), (void*)context->service_name},
+  };
+  SecKeychainAttributeList list = {2, attr_list};
+  OSStatus status = SecKeychainItemModifyAttributesAndData(ref, &list, 0, NULL);
+  if (status != noErr) {
+    fprintf(stderr, "%s: failed to rename %s.%s (%d)\n", envchain_name, name, key, (int)status);
+    context->failures++;
   }
 }
+
+static int
+envchain_keychain_rename_values(const char *name, const char *new_name,
+                                envchain_key_match_callback match, void *data)
+{
+  char *service_name = envchain_generate_service_name(new_name);
+  envchain_keychain_rename_values_context context = {match, data, service_name, 0};
+
+  uint64_t trace_begin = envchain_trace_begin();
+  envchain_keychain_each_item(name, &envchain_keychain_rename_values_applier, &context);
+  envchain_trace_end(ENVCHAIN_TRACE_STORE, trace_begin);
+  free(service_name);
+  return context.failures;
+}
+
+const envchain_backend envchain_backend_keychain = {
+  "keychain",
+  envchain_keychain_search_namespaces,
+  envchain_keychain_search_keys,
+  envchain_keychain_search_values_multi,
+  envchain_keychain_save_values,
+  envchain_keychain_delete_values,
+  envchain_keychain_rename_values,
+  NULL, /* no change notifications to watch */
+};
@@ -0,0 +1,298 @@
+/*
+ * Namespace selectors of exec mode:
+ *
+ *   aws                     every key of aws
+ *   aws:KEY1,KEY2           only KEY1 and KEY2 of aws
+ *   aws:KEY1,KEY2,hubot:    ... followed by every key of hubot
+ *
+ * A bare token following NAMESPACE:KEY is another key of that namespace;
+ * following NAMESPACE or NAMESPACE: it is another namespace.
+ *
+ *   aws-prod-*:KEY1         KEY1 of every namespace matching the glob
+ *
+ * envchain_selectors_expand() replaces glob selectors with the namespaces they
+ * match, in strcmp order, so that values of the last one take precedence. A
+ * namespace selected more than once gets the keys of all its selectors: at its
+ * own place when named explicitly, else at the place of the first glob.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fnmatch.h>
+
+#include "envchain.h"
+
+envchain_selector*
+envchain_selectors_parse(char *spec, int *count)
+{
+  size_t tokens = 1;
+  envchain_selector *selectors, *current = NULL;
+  const char **next_key;
+  char *token, *colon;
+  int n = 0;
+
+  for (const char *p = spec; *p; p++) {
+    if (*p == ',') tokens++;
+  }
+
+  /* one block: selectors, then the keys they point into */
+  selectors = malloc((sizeof(envchain_selector) + sizeof(char*)) * tokens);
+  if (selectors == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  next_key = (const char**)(selectors + tokens);
+
+  while ((token = strsep(&spec, ",")) != NULL) {
+    colon = strchr(token, ':');
+
+    if (colon == NULL && current != NULL && current->keys != NULL) {
+      if (token[0] != '\0') {
+        *next_key++ = token;
+        current->keys_count++;
+      }
+      continue;
+    }
+
+    current = &selectors[n++];
+    current->name = token;
+    current->keys = NULL;
+    current->keys_count = 0;
+
+    if (colon != NULL) {
+      *colon = '\0';
+      if (colon[1] != '\0') {
+        current->keys = next_key;
+        *next_key++ = colon + 1;
+        current->keys_count = 1;
+      }
+    }
+  }
+
+  *count = n;
+  return selectors;
+}
+
+int
+envchain_selector_has_key(const envchain_selector *selector, const char *key)
+{
+  if (selector->keys == NULL) return 1;
+  for (int i = 0; i < selector->keys_count; i++) {
+    if (key != NULL && strcmp(selector->keys[i], key) == 0) return 1;
+  }
+  return 0;
+}
+
+int
+envchain_is_glob(const char *pattern)
+{
+  return strpbrk(pattern, "*?[") != NULL;
+}
+
+typedef struct {
+  char **names;
+  int count;
+  int capacity;
+} envchain_selector_names;
+
+static void
+envchain_selector_names_add(const char *name, void *raw_names)
+{
+  envchain_selector_names *names = raw_names;
+
+  if (names->count == names->capacity) {
+    names->capacity = names->capacity ? names->capacity * 2 : 32;
+    names->names = realloc(names->names, sizeof(char*) * names->capacity);
+    if (names->names == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+  names->names[names->count++] = strdup(name);
+}
+
+static int
+envchain_selector_names_cmp(const void *a, const void *b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+typedef struct {
+  const char **keys;
+  int count;
+  int capacity;
+} envchain_selector_keys;
+
+static void
+envchain_selector_keys_add(envchain_selector_keys *list, const char **keys, int count)
+{
+  for (int i = 0; i < count; i++) {
+    int j;
+    for (j = 0; j < list->count; j++) {
+      if (strcmp(list->keys[j], keys[i]) == 0) break;
+    }
+    if (j < list->count) continue;
+
+    if (list->count == list->capacity) {
+      list->capacity = list->capacity ? list->capacity * 2 : 8;
+      list->keys = realloc(list->keys, sizeof(char*) * list->capacity);
+      if (list->keys == NULL) {
+        fprintf(stderr, "%s: malloc failed\n", envchain_name);
+        exit(10);
+      }
+    }
+    list->keys[list->count++] = keys[i];
+  }
+}
+
+/* Index of name in the sorted names, or -1 */
+static int
+envchain_selector_names_find(const envchain_selector_names *names, const char *name)
+{
+  char **found = bsearch(&name, names->names, names->count, sizeof(char*), &envchain_selector_names_cmp);
+  return found ? (int)(found - names->names) : -1;
+}
+
+int
+envchain_selectors_expand(envchain_selector **selectors_ptr, int *count)
+{
+  envchain_selector *selectors = *selectors_ptr, *expanded;
+  envchain_selector_names names = {NULL, 0, 0};
+  envchain_selector_keys *glob_keys, *keys;
+  int *glob_all, *named, *placed, *source, *name_index, *all;
+  const char **next_key;
+  char *next_name;
+  int expanded_count = 0, keys_count = 0, i, j, n;
+  size_t names_bytes = 0;
+
+  for (i = 0; i < *count; i++) {
+    if (envchain_is_glob(selectors[i].name)) break;
+  }
+  if (i == *count) return 0;
+
+  /* one enumeration of namespaces serves every glob */
+  if (envchain_search_namespaces(&envchain_selector_names_add, &names) != 0) {
+    for (j = 0; j < names.count; j++) free(names.names[j]);
+    free(names.names);
+    return 1;
+  }
+  qsort(names.names, names.count, sizeof(char*), &envchain_selector_names_cmp);
+  for (i = 0, n = 0; i < names.count; i++) {
+    if (0 < n && strcmp(names.names[n - 1], names.names[i]) == 0) free(names.names[i]);
+    else names.names[n++] = names.names[i];
+  }
+  names.count = n;
+
+  n = *count + names.count;
+  glob_keys = calloc(names.count + 1, sizeof(envchain_selector_keys));
+  glob_all = calloc(names.count + 1, sizeof(int));
+  named = calloc(names.count + 1, sizeof(int));
+  placed = calloc(names.count + 1, sizeof(int));
+  keys = calloc(n, sizeof(envchain_selector_keys));
+  source = calloc(n, sizeof(int));
+  name_index = calloc(n, sizeof(int));
+  all = calloc(n, sizeof(int));
+  if (!glob_keys || !glob_all || !named || !placed || !keys || !source || !name_index || !all) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+
+  /* what the globs select of each namespace: every key, or the union of their lists */
+  for (i = 0; i < *count; i++) {
+    int matched = 0;
+
+    if (!envchain_is_glob(selectors[i].name)) {
+      j = envchain_selector_names_find(&names, selectors[i].name);
+      if (0 <= j) named[j] = 1;
+      continue;
+    }
+    for (j = 0; j < names.count; j++) {
+      if (fnmatch(selectors[i].name, names.names[j], 0) != 0) continue;
+      matched = 1;
+      if (selectors[i].keys == NULL) glob_all[j] = 1;
+      else envchain_selector_keys_add(&glob_keys[j], selectors[i].keys, selectors[i].keys_count);
+    }
+    if (!matched) fprintf(stderr, "WARNING: nothing matched `%s`.\n", selectors[i].name);
+  }
+
+  /*
+   * Namespaces given by name keep their place, and get the keys of the globs
+   * matching them too; the others take the place of the first glob matching
+   * them, with the keys of every such glob.
+   */
+  for (i = 0; i < *count; i++) {
+    if (!envchain_is_glob(selectors[i].name)) {
+      j = envchain_selector_names_find(&names, selectors[i].name);
+      source[expanded_count] = i;
+      name_index[expanded_count] = -1;
+      all[expanded_count] = selectors[i].keys == NULL || (0 <= j && glob_all[j]);
+      if (!all[expanded_count]) {
+        envchain_selector_keys_add(&keys[expanded_count], selectors[i].keys, selectors[i].keys_count);
+        if (0 <= j) envchain_selector_keys_add(&keys[expanded_count], glob_keys[j].keys, glob_keys[j].count);
+      }
+      keys_count += keys[expanded_count].count;
+      expanded_count++;
+      continue;
+    }
+    for (j = 0; j < names.count; j++) {
+      if (named[j] || placed[j] || fnmatch(selectors[i].name, names.names[j], 0) != 0) continue;
+      placed[j] = 1;
+      source[expanded_count] = i;
+      name_index[expanded_count] = j;
+      all[expanded_count] = glob_all[j];
+      if (!glob_all[j]) envchain_selector_keys_add(&keys[expanded_count], glob_keys[j].keys, glob_keys[j].count);
+      keys_count += keys[expanded_count].count;
+      names_bytes += strlen(names.names[j]) + 1;
+      expanded_count++;
+    }
+  }
+
+  /* one block again: selectors, the keys they point into, then matched names */
+  expanded = malloc(sizeof(envchain_selector) * (expanded_count + 1) + sizeof(char*) * keys_count + names_bytes);
+  if (expanded == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  next_key = (const char**)(expanded + expanded_count + 1);
+  next_name = (char*)(next_key + keys_count);
+
+  for (i = 0; i < expanded_count; i++) {
+    expanded[i].name = selectors[source[i]].name;
+    if (0 <= name_index[i]) {
+      size_t len = strlen(names.names[name_index[i]]) + 1;
+      memcpy(next_name, names.names[name_index[i]], len);
+      expanded[i].name = next_name;
+      next_name += len;
+    }
+    expanded[i].keys = NULL;
+    expanded[i].keys_count = 0;
+    if (!all[i]) {
+      memcpy(next_key, keys[i].keys, sizeof(char*) * keys[i].count);
+      expanded[i].keys = next_key;
+      expanded[i].keys_count = keys[i].count;
+      next_key += keys[i].count;
+    }
+    free(keys[i].keys);
+  }
+
+  for (j = 0; j < names.count; j++) {
+    free(names.names[j]);
+    free(glob_keys[j].keys);
+  }
+  free(names.names);
+  free(glob_keys);
+  free(glob_all);
+  free(named);
+  free(placed);
+  free(keys);
+  free(source);
+  free(name_index);
+  free(all);
+  free(selectors);
+  *selectors_ptr = expanded;
+  *count = expanded_count;
+  return 0;
+}
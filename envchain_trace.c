@@ -0,0 +1,154 @@
+/*
+ * Latency tracing. Enabled with --trace[=FILE] or ENVCHAIN_TRACE=1|FILE;
+ * when enabled, a one-line JSON summary of time spent per phase and backend
+ * counters is written to stderr (or appended to FILE) before exec or exit.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "envchain.h"
+
+static const char *envchain_trace_phase_names[ENVCHAIN_TRACE_PHASES] = {
+  "connect", "unlock", "search", "load", "store", "delete", "agent", "coalesce",
+  "prepare",
+};
+
+static const char *envchain_trace_counter_names[ENVCHAIN_TRACE_COUNTERS] = {
+  "dbus_calls", "retries", "items", "bytes",
+};
+
+int envchain_trace_enabled = 0;
+
+static char *envchain_trace_path = NULL;
+static const char *envchain_trace_mode = "";
+static uint64_t envchain_trace_started_at;
+static uint64_t envchain_trace_phase_ns[ENVCHAIN_TRACE_PHASES];
+static uint64_t envchain_trace_phase_count[ENVCHAIN_TRACE_PHASES];
+static uint64_t envchain_trace_counters[ENVCHAIN_TRACE_COUNTERS];
+
+/* CLOCK_MONOTONIC needs OS X 10.12, so Darwin uses the mach clock */
+uint64_t
+envchain_monotonic_ns(void)
+{
+#ifdef __APPLE__
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) mach_timebase_info(&timebase);
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+void
+envchain_trace_init(const char *dest, const char *mode)
+{
+  if (dest == NULL) dest = getenv("ENVCHAIN_TRACE");
+  if (dest == NULL || dest[0] == '\0' || strcmp(dest, "0") == 0) return;
+
+  envchain_trace_enabled = 1;
+  envchain_trace_mode = mode;
+  envchain_trace_started_at = envchain_monotonic_ns();
+  if (strcmp(dest, "1") != 0 && strcmp(dest, "stderr") != 0) {
+    envchain_trace_path = strdup(dest);
+  }
+  atexit(&envchain_trace_flush);
+}
+
+uint64_t
+envchain_trace_begin(void)
+{
+  if (!envchain_trace_enabled) return 0;
+  return envchain_monotonic_ns();
+}
+
+void
+envchain_trace_end(envchain_trace_phase phase, uint64_t begin)
+{
+  if (!envchain_trace_enabled) return;
+  envchain_trace_phase_ns[phase] += envchain_monotonic_ns() - begin;
+  envchain_trace_phase_count[phase]++;
+}
+
+void
+envchain_trace_count(envchain_trace_counter counter, uint64_t n)
+{
+  if (!envchain_trace_enabled) return;
+  envchain_trace_counters[counter] += n;
+}
+
+/* snprintf at line + *len, advancing *len; what doesn't fit in size is cut off */
+static void
+envchain_trace_append(char *line, size_t size, size_t *len, const char *format, ...)
+{
+  va_list args;
+  int n;
+
+  if (size <= *len) return;
+  va_start(args, format);
+  n = vsnprintf(line + *len, size - *len, format, args);
+  va_end(args);
+  if (n < 0) return;
+  *len = size - *len <= (size_t)n ? size - 1 : *len + n;
+}
+
+void
+envchain_trace_flush(void)
+{
+  /* every phase and counter with 20 digit values fits several times over */
+  char line[2048];
+  size_t line_len = 0;
+  int fd;
+
+  if (!envchain_trace_enabled) return;
+  envchain_trace_enabled = 0; /* only once, before exec or at exit */
+
+  envchain_trace_append(line, sizeof(line), &line_len,
+                        "{\"envchain_trace\":{\"pid\":%d,\"mode\":\"%s\",\"total_us\":%llu,\"phases\":{",
+                        (int)getpid(), envchain_trace_mode,
+                        (unsigned long long)((envchain_monotonic_ns() - envchain_trace_started_at) / 1000));
+  for (int i = 0, first = 1; i < ENVCHAIN_TRACE_PHASES; i++) {
+    if (envchain_trace_phase_count[i] == 0) continue;
+    envchain_trace_append(line, sizeof(line), &line_len, "%s\"%s\":{\"us\":%llu,\"count\":%llu}",
+                          first ? "" : ",", envchain_trace_phase_names[i],
+                          (unsigned long long)(envchain_trace_phase_ns[i] / 1000),
+                          (unsigned long long)envchain_trace_phase_count[i]);
+    first = 0;
+  }
+  envchain_trace_append(line, sizeof(line), &line_len, "}");
+  for (int i = 0; i < ENVCHAIN_TRACE_COUNTERS; i++) {
+    envchain_trace_append(line, sizeof(line), &line_len, ",\"%s\":%llu", envchain_trace_counter_names[i],
+                          (unsigned long long)envchain_trace_counters[i]);
+  }
+  envchain_trace_append(line, sizeof(line), &line_len, "}}\n");
+
+  if (envchain_trace_path) {
+    fd = open(envchain_trace_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      fprintf(stderr, "%s: unable to open trace file %s\n", envchain_name, envchain_trace_path);
+      fd = STDERR_FILENO;
+    }
+  }
+  else {
+    fd = STDERR_FILENO;
+  }
+
+  /* a single write keeps lines from concurrent invocations intact */
+  if (write(fd, line, line_len) < 0) {
+    /* nothing sensible to do */
+  }
+  if (fd != STDERR_FILENO) close(fd);
+}
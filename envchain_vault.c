@@ -0,0 +1,953 @@
+/*
+ * File vault backend (ENVCHAIN_BACKEND=vault) for hosts without a keychain
+ * or D-Bus session. Everything lives in one file, memory-mapped for reading:
+ *
+ *   header   "ENVCHVLT", u32 version, u32 count, u32 index_len,
+ *            12-byte index nonce, 16 reserved bytes              (48 bytes)
+ *   index    index_len encrypted bytes and a tag, authenticated with the
+ *            header; count entries sorted by (name, key), each
+ *            u32 name_len, u32 key_len, u32 value_len, u64 offset,
+ *            name, NUL, key, NUL
+ *   records  at offset: 12-byte nonce, value_len encrypted bytes and a tag,
+ *            authenticated with "name NUL key"
+ *
+ * Integers are little-endian. Encryption is ChaCha20-Poly1305 with the
+ * 32-byte key kept (hex encoded) in ENVCHAIN_VAULT_KEY. A lookup decrypts the
+ * index and then only the records it selects.
+ *
+ * Sealed bundles (envchain --seal) use the same format.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "envchain.h"
+
+#define ENVCHAIN_VAULT_MAGIC "ENVCHVLT"
+#define ENVCHAIN_VAULT_VERSION 1
+#define ENVCHAIN_VAULT_HEADER_SIZE 48
+/* offsets into the header */
+#define ENVCHAIN_VAULT_VERSION_OFFSET 8
+#define ENVCHAIN_VAULT_COUNT_OFFSET 12
+#define ENVCHAIN_VAULT_INDEX_LEN_OFFSET 16
+#define ENVCHAIN_VAULT_NONCE_OFFSET 20
+#define ENVCHAIN_VAULT_ENTRY_SIZE 20
+#define ENVCHAIN_VAULT_RECORD_OVERHEAD (ENVCHAIN_AEAD_NONCE_SIZE + ENVCHAIN_AEAD_TAG_SIZE)
+
+typedef struct {
+  const char *name;
+  uint32_t name_len;
+  const char *key;
+  uint32_t key_len;
+  uint32_t value_len;
+  uint64_t offset;
+} envchain_vault_entry;
+
+typedef struct {
+  unsigned char key[ENVCHAIN_AEAD_KEY_SIZE];
+  unsigned char *map;
+  size_t map_len;
+  unsigned char *index; /* decrypted */
+  uint32_t index_len;
+  envchain_vault_entry *entries;
+  uint32_t count;
+} envchain_vault;
+
+/* an entry of a vault being written */
+typedef struct {
+  const char *name;
+  uint32_t name_len;
+  const char *key;
+  uint32_t key_len;
+  uint32_t value_len;
+  const unsigned char *record; /* copied as is when set */
+  const char *value;           /* sealed otherwise */
+  size_t seq;
+} envchain_vault_item;
+
+/* a key a selector of the bundle selects, listed before the values are fetched */
+typedef struct {
+  int selector;
+  char *key;
+  int sealed;
+} envchain_vault_seal_source;
+
+typedef struct {
+  envchain_vault_item *items;
+  size_t count;
+  size_t capacity;
+  const envchain_selector *selectors;
+  int selectors_count;
+  envchain_vault_seal_source *sources; /* in selector order */
+  size_t sources_count;
+  size_t sources_capacity;
+  size_t cursor; /* first source of the selector being fetched */
+  int failed;
+} envchain_vault_seal_context;
+
+/* set by envchain_vault_use() */
+static const char *envchain_vault_path_override = NULL;
+static const char *envchain_vault_key_path_override = NULL;
+
+/* misc */
+
+static uint32_t
+envchain_vault_get32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+envchain_vault_get64(const unsigned char *p)
+{
+  return (uint64_t)envchain_vault_get32(p) | ((uint64_t)envchain_vault_get32(p + 4) << 32);
+}
+
+static void
+envchain_vault_put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+envchain_vault_put64(unsigned char *p, uint64_t v)
+{
+  envchain_vault_put32(p, (uint32_t)v);
+  envchain_vault_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static int
+envchain_vault_bytes_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+  int r = memcmp(a, b, a_len < b_len ? a_len : b_len);
+  if (r != 0) return r;
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+static void*
+envchain_vault_alloc(size_t size)
+{
+  void *ptr = calloc(1, size ? size : 1);
+  if (ptr == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  return ptr;
+}
+
+static char*
+envchain_vault_path(void)
+{
+  const char *path = getenv("ENVCHAIN_VAULT"), *base;
+  char *result;
+
+  if (envchain_vault_path_override) return strdup(envchain_vault_path_override);
+  if (path && path[0] != '\0') return strdup(path);
+
+  if ((base = getenv("XDG_CONFIG_HOME")) && base[0] != '\0') {
+    if (asprintf(&result, "%s/envchain/vault", base) < 0) return NULL;
+  }
+  else if ((base = getenv("HOME")) && base[0] != '\0') {
+    if (asprintf(&result, "%s/.config/envchain/vault", base) < 0) return NULL;
+  }
+  else {
+    fprintf(stderr, "%s: set ENVCHAIN_VAULT to the path of the vault file\n", envchain_name);
+    return NULL;
+  }
+  return result;
+}
+
+static char*
+envchain_vault_key_path(const char *vault_path)
+{
+  const char *path = getenv("ENVCHAIN_VAULT_KEY");
+  char *result;
+
+  if (envchain_vault_key_path_override) return strdup(envchain_vault_key_path_override);
+  if (path && path[0] != '\0') return strdup(path);
+  if (asprintf(&result, "%s.key", vault_path) < 0) return NULL;
+  return result;
+}
+
+static int
+envchain_vault_hex_value(char c)
+{
+  if ('0' <= c && c <= '9') return c - '0';
+  if ('a' <= c && c <= 'f') return c - 'a' + 10;
+  if ('A' <= c && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static int
+envchain_vault_create_key(const char *path, unsigned char key[ENVCHAIN_AEAD_KEY_SIZE])
+{
+  static const char digits[] = "0123456789abcdef";
+  char hex[ENVCHAIN_AEAD_KEY_SIZE * 2 + 1];
+  int fd, i;
+
+  if (envchain_random_bytes(key, ENVCHAIN_AEAD_KEY_SIZE) < 0) {
+    fprintf(stderr, "%s: unable to generate a vault key\n", envchain_name);
+    return -1;
+  }
+  for (i = 0; i < ENVCHAIN_AEAD_KEY_SIZE; i++) {
+    hex[i * 2] = digits[key[i] >> 4];
+    hex[i * 2 + 1] = digits[key[i] & 0xf];
+  }
+  hex[sizeof(hex) - 1] = '\n';
+
+  fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0 || write(fd, hex, sizeof(hex)) != (ssize_t)sizeof(hex) || fsync(fd) < 0) {
+    fprintf(stderr, "%s: unable to create vault key %s: %s\n", envchain_name, path, strerror(errno));
+    if (0 <= fd) close(fd);
+    memset(hex, 0, sizeof(hex));
+    return -1;
+  }
+  close(fd);
+  memset(hex, 0, sizeof(hex));
+
+  fprintf(stderr, "%s: created vault key %s; keep a copy, values can't be read without it\n",
+          envchain_name, path);
+  return 0;
+}
+
+/* Reads the hex encoded key at path; when missing and create is set, generates one */
+static int
+envchain_vault_load_key(const char *path, unsigned char key[ENVCHAIN_AEAD_KEY_SIZE], int create)
+{
+  char buf[ENVCHAIN_AEAD_KEY_SIZE * 2 + 3];
+  ssize_t len = 0, n;
+  int fd, i;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT && create) return envchain_vault_create_key(path, key);
+    fprintf(stderr, "%s: unable to open vault key %s: %s\n", envchain_name, path, strerror(errno));
+    return -1;
+  }
+  while ((size_t)len < sizeof(buf) && (n = read(fd, buf + len, sizeof(buf) - len)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    len += n;
+  }
+  close(fd);
+
+  while (0 < len && (buf[len - 1] == '\n' || buf[len - 1] == '\r' || buf[len - 1] == ' ')) len--;
+  if (len != ENVCHAIN_AEAD_KEY_SIZE * 2) goto invalid;
+  for (i = 0; i < ENVCHAIN_AEAD_KEY_SIZE; i++) {
+    int hi = envchain_vault_hex_value(buf[i * 2]), lo = envchain_vault_hex_value(buf[i * 2 + 1]);
+    if (hi < 0 || lo < 0) goto invalid;
+    key[i] = (hi << 4) | lo;
+  }
+  memset(buf, 0, sizeof(buf));
+  return 0;
+
+invalid:
+  memset(buf, 0, sizeof(buf));
+  fprintf(stderr, "%s: vault key %s must hold %d hex digits\n", envchain_name, path,
+          ENVCHAIN_AEAD_KEY_SIZE * 2);
+  return -1;
+}
+
+/* reading */
+
+static int
+envchain_vault_parse_index(envchain_vault *vault)
+{
+  const unsigned char *p = vault->index, *end = vault->index + vault->index_len;
+  uint32_t i;
+
+  vault->entries = envchain_vault_alloc(sizeof(envchain_vault_entry) * vault->count);
+  for (i = 0; i < vault->count; i++) {
+    envchain_vault_entry *entry = &vault->entries[i];
+
+    if ((size_t)(end - p) < ENVCHAIN_VAULT_ENTRY_SIZE) return -1;
+    entry->name_len = envchain_vault_get32(p);
+    entry->key_len = envchain_vault_get32(p + 4);
+    entry->value_len = envchain_vault_get32(p + 8);
+    entry->offset = envchain_vault_get64(p + 12);
+    p += ENVCHAIN_VAULT_ENTRY_SIZE;
+
+    if ((size_t)(end - p) < (size_t)entry->name_len + entry->key_len + 2) return -1;
+    entry->name = (const char*)p;
+    entry->key = (const char*)p + entry->name_len + 1;
+    if (entry->name[entry->name_len] != '\0' || entry->key[entry->key_len] != '\0') return -1;
+    p += entry->name_len + entry->key_len + 2;
+
+    if (vault->map_len < entry->offset
+        || vault->map_len - entry->offset < (uint64_t)entry->value_len + ENVCHAIN_VAULT_RECORD_OVERHEAD)
+      return -1;
+  }
+  return p == end ? 0 : -1;
+}
+
+static void
+envchain_vault_close(envchain_vault *vault)
+{
+  if (vault->map) munmap(vault->map, vault->map_len);
+  if (vault->index) {
+    memset(vault->index, 0, vault->index_len);
+    free(vault->index);
+  }
+  free(vault->entries);
+  memset(vault, 0, sizeof(*vault));
+}
+
+/* Opens the vault at path; a missing file is an empty vault. */
+static int
+envchain_vault_open(envchain_vault *vault, const char *path, int create_key)
+{
+  struct stat st;
+  char *key_path;
+  int fd, result;
+
+  memset(vault, 0, sizeof(*vault));
+
+  key_path = envchain_vault_key_path(path);
+  if (key_path == NULL) return -1;
+  /* a new key only for a new vault; an existing one would become unreadable */
+  if (create_key && stat(path, &st) == 0 && 0 < st.st_size) {
+    create_key = 0;
+    if (access(key_path, F_OK) < 0 && errno == ENOENT) {
+      fprintf(stderr, "%s: vault key %s missing; vault %s can't be read or written without it\n",
+              envchain_name, key_path, path);
+      free(key_path);
+      return -1;
+    }
+  }
+  result = envchain_vault_load_key(key_path, vault->key, create_key);
+  free(key_path);
+  if (result < 0) return -1;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) return 0;
+    fprintf(stderr, "%s: unable to open vault %s: %s\n", envchain_name, path, strerror(errno));
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  vault->map_len = st.st_size;
+  vault->map = mmap(NULL, vault->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (vault->map == MAP_FAILED) {
+    vault->map = NULL;
+    fprintf(stderr, "%s: unable to map vault %s: %s\n", envchain_name, path, strerror(errno));
+    return -1;
+  }
+
+  if (vault->map_len < ENVCHAIN_VAULT_HEADER_SIZE
+      || memcmp(vault->map, ENVCHAIN_VAULT_MAGIC, 8) != 0
+      || envchain_vault_get32(vault->map + ENVCHAIN_VAULT_VERSION_OFFSET) != ENVCHAIN_VAULT_VERSION) {
+    fprintf(stderr, "%s: %s is not an envchain vault\n", envchain_name, path);
+    goto fail;
+  }
+  vault->count = envchain_vault_get32(vault->map + ENVCHAIN_VAULT_COUNT_OFFSET);
+  vault->index_len = envchain_vault_get32(vault->map + ENVCHAIN_VAULT_INDEX_LEN_OFFSET);
+  if (vault->map_len - ENVCHAIN_VAULT_HEADER_SIZE < (size_t)vault->index_len + ENVCHAIN_AEAD_TAG_SIZE
+      || vault->index_len / ENVCHAIN_VAULT_ENTRY_SIZE < vault->count) {
+    fprintf(stderr, "%s: vault %s is truncated\n", envchain_name, path);
+    goto fail;
+  }
+
+  vault->index = envchain_vault_alloc(vault->index_len);
+  if (envchain_aead_open(vault->key, vault->map + ENVCHAIN_VAULT_NONCE_OFFSET, vault->map, ENVCHAIN_VAULT_HEADER_SIZE,
+                         vault->map + ENVCHAIN_VAULT_HEADER_SIZE, vault->index_len,
+                         vault->map + ENVCHAIN_VAULT_HEADER_SIZE + vault->index_len,
+                         vault->index) < 0) {
+    fprintf(stderr, "%s: vault %s can't be decrypted with this key\n", envchain_name, path);
+    goto fail;
+  }
+  if (envchain_vault_parse_index(vault) < 0) {
+    fprintf(stderr, "%s: vault %s has a corrupt index\n", envchain_name, path);
+    goto fail;
+  }
+  return 0;
+
+fail:
+  envchain_vault_close(vault);
+  return -1;
+}
+
+/* Returns the first entry not less than (name, key) */
+static uint32_t
+envchain_vault_lower_bound(const envchain_vault *vault, const char *name, size_t name_len,
+                           const char *key, size_t key_len)
+{
+  uint32_t lo = 0, hi = vault->count;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const envchain_vault_entry *entry = &vault->entries[mid];
+    int r = envchain_vault_bytes_cmp(entry->name, entry->name_len, name, name_len);
+    if (r == 0) r = envchain_vault_bytes_cmp(entry->key, entry->key_len, key, key_len);
+    if (r < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static char*
+envchain_vault_aad(const char *name, size_t name_len, const char *key, size_t key_len, size_t *len)
+{
+  char *aad = envchain_vault_alloc(name_len + key_len + 1);
+  memcpy(aad, name, name_len);
+  memcpy(aad + name_len + 1, key, key_len);
+  *len = name_len + key_len + 1;
+  return aad;
+}
+
+/* Decrypts the value of entry; NULL when it fails authentication */
+static char*
+envchain_vault_read_value(const envchain_vault *vault, const envchain_vault_entry *entry)
+{
+  const unsigned char *record = vault->map + entry->offset;
+  char *value = envchain_vault_alloc((size_t)entry->value_len + 1);
+  size_t aad_len;
+  char *aad = envchain_vault_aad(entry->name, entry->name_len, entry->key, entry->key_len, &aad_len);
+  int result;
+
+  result = envchain_aead_open(vault->key, record, (unsigned char*)aad, aad_len,
+                              record + ENVCHAIN_AEAD_NONCE_SIZE, entry->value_len,
+                              record + ENVCHAIN_AEAD_NONCE_SIZE + entry->value_len,
+                              (unsigned char*)value);
+  free(aad);
+  if (result < 0) {
+    free(value);
+    return NULL;
+  }
+  return value;
+}
+
+static int
+envchain_vault_emit(const envchain_vault *vault, const envchain_vault_entry *entry,
+                    envchain_search_callback callback, void *data)
+{
+  char *value = envchain_vault_read_value(vault, entry);
+  if (value == NULL) {
+    fprintf(stderr, "%s: vault record %s.%s failed authentication\n", envchain_name,
+            entry->name, entry->key);
+    return 1;
+  }
+  envchain_trace_count(ENVCHAIN_TRACE_ITEMS, 1);
+  envchain_trace_count(ENVCHAIN_TRACE_BYTES, entry->value_len);
+  callback(entry->key, value, entry->value_len, data);
+  memset(value, 0, entry->value_len);
+  free(value);
+  return 0;
+}
+
+static int
+envchain_vault_search_namespaces(envchain_namespace_search_callback callback, void *data)
+{
+  envchain_vault vault;
+  char *path = envchain_vault_path();
+  uint32_t i;
+
+  if (path == NULL || envchain_vault_open(&vault, path, 0) < 0) {
+    free(path);
+    return 1;
+  }
+  free(path);
+
+  for (i = 0; i < vault.count; i++) {
+    if (0 < i && envchain_vault_bytes_cmp(vault.entries[i - 1].name, vault.entries[i - 1].name_len,
+                                          vault.entries[i].name, vault.entries[i].name_len) == 0)
+      continue;
+    callback(vault.entries[i].name, data);
+  }
+
+  envchain_vault_close(&vault);
+  return 0;
+}
+
+static int
+envchain_vault_search_keys(envchain_key_search_callback callback, void *data)
+{
+  envchain_vault vault;
+  char *path = envchain_vault_path();
+
+  if (path == NULL || envchain_vault_open(&vault, path, 0) < 0) {
+    free(path);
+    return 1;
+  }
+  free(path);
+
+  /* the index alone; no value is decrypted */
+  for (uint32_t i = 0; i < vault.count; i++) {
+    callback(vault.entries[i].name, vault.entries[i].key, data);
+  }
+
+  envchain_vault_close(&vault);
+  return 0;
+}
+
+static int
+envchain_vault_search_values_multi(const envchain_selector *selectors, int selectors_count,
+                                   envchain_search_callback callback, void *data)
+{
+  envchain_vault vault;
+  char *path = envchain_vault_path();
+  int result = 0, i, j;
+
+  uint64_t trace_begin = envchain_trace_begin();
+  if (path == NULL || envchain_vault_open(&vault, path, 0) < 0) {
+    free(path);
+    return 1;
+  }
+  free(path);
+  envchain_trace_end(ENVCHAIN_TRACE_SEARCH, trace_begin);
+
+  trace_begin = envchain_trace_begin();
+  for (i = 0; i < selectors_count; i++) {
+    const char *name = selectors[i].name;
+    size_t name_len = strlen(name);
+
+    if (selectors[i].keys == NULL) {
+      uint32_t pos = envchain_vault_lower_bound(&vault, name, name_len, "", 0);
+      for (; pos < vault.count; pos++) {
+        const envchain_vault_entry *entry = &vault.entries[pos];
+        if (envchain_vault_bytes_cmp(entry->name, entry->name_len, name, name_len) != 0) break;
+        result |= envchain_vault_emit(&vault, entry, callback, data);
+      }
+      continue;
+    }
+
+    for (j = 0; j < selectors[i].keys_count; j++) {
+      const char *key = selectors[i].keys[j];
+      size_t key_len = strlen(key);
+      uint32_t pos = envchain_vault_lower_bound(&vault, name, name_len, key, key_len);
+      if (pos == vault.count) continue;
+      const envchain_vault_entry *entry = &vault.entries[pos];
+      if (envchain_vault_bytes_cmp(entry->name, entry->name_len, name, name_len) != 0
+          || envchain_vault_bytes_cmp(entry->key, entry->key_len, key, key_len) != 0)
+        continue;
+      result |= envchain_vault_emit(&vault, entry, callback, data);
+    }
+  }
+  envchain_trace_end(ENVCHAIN_TRACE_LOAD, trace_begin);
+
+  envchain_vault_close(&vault);
+  return result;
+}
+
+/* writing */
+
+static int
+envchain_vault_item_cmp(const void *a, const void *b)
+{
+  const envchain_vault_item *x = a, *y = b;
+  int r = envchain_vault_bytes_cmp(x->name, x->name_len, y->name, y->name_len);
+  if (r == 0) r = envchain_vault_bytes_cmp(x->key, x->key_len, y->key, y->key_len);
+  if (r == 0) r = (x->seq > y->seq) - (x->seq < y->seq);
+  return r;
+}
+
+/* Writes items as a vault; for duplicate (name, key) pairs the item added last wins */
+static int
+envchain_vault_write(FILE *out, const unsigned char key[ENVCHAIN_AEAD_KEY_SIZE],
+                     envchain_vault_item *items, size_t count)
+{
+  unsigned char header[ENVCHAIN_VAULT_HEADER_SIZE], tag[ENVCHAIN_AEAD_TAG_SIZE];
+  unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE];
+  unsigned char *index, *p;
+  size_t index_len = 0, n = 0, i;
+  uint64_t offset;
+
+  qsort(items, count, sizeof(envchain_vault_item), envchain_vault_item_cmp);
+  for (i = 0; i < count; i++) {
+    if (i + 1 < count
+        && envchain_vault_bytes_cmp(items[i].name, items[i].name_len, items[i + 1].name, items[i + 1].name_len) == 0
+        && envchain_vault_bytes_cmp(items[i].key, items[i].key_len, items[i + 1].key, items[i + 1].key_len) == 0)
+      continue;
+    items[n++] = items[i];
+    index_len += ENVCHAIN_VAULT_ENTRY_SIZE + items[i].name_len + items[i].key_len + 2;
+  }
+  count = n;
+  if (UINT32_MAX < index_len) return -1;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, ENVCHAIN_VAULT_MAGIC, 8);
+  envchain_vault_put32(header + ENVCHAIN_VAULT_VERSION_OFFSET, ENVCHAIN_VAULT_VERSION);
+  envchain_vault_put32(header + ENVCHAIN_VAULT_COUNT_OFFSET, count);
+  envchain_vault_put32(header + ENVCHAIN_VAULT_INDEX_LEN_OFFSET, index_len);
+  if (envchain_random_bytes(header + ENVCHAIN_VAULT_NONCE_OFFSET, ENVCHAIN_AEAD_NONCE_SIZE) < 0) return -1;
+
+  index = envchain_vault_alloc(index_len);
+  offset = ENVCHAIN_VAULT_HEADER_SIZE + index_len + ENVCHAIN_AEAD_TAG_SIZE;
+  for (i = 0, p = index; i < count; i++) {
+    envchain_vault_put32(p, items[i].name_len);
+    envchain_vault_put32(p + 4, items[i].key_len);
+    envchain_vault_put32(p + 8, items[i].value_len);
+    envchain_vault_put64(p + 12, offset);
+    p += ENVCHAIN_VAULT_ENTRY_SIZE;
+    memcpy(p, items[i].name, items[i].name_len);
+    p += items[i].name_len + 1;
+    memcpy(p, items[i].key, items[i].key_len);
+    p += items[i].key_len + 1;
+    offset += (uint64_t)items[i].value_len + ENVCHAIN_VAULT_RECORD_OVERHEAD;
+  }
+  envchain_aead_seal(key, header + ENVCHAIN_VAULT_NONCE_OFFSET, header, sizeof(header), index, index_len, index, tag);
+
+  fwrite(header, 1, sizeof(header), out);
+  fwrite(index, 1, index_len, out);
+  fwrite(tag, 1, sizeof(tag), out);
+  free(index);
+
+  for (i = 0; i < count; i++) {
+    const envchain_vault_item *item = &items[i];
+    unsigned char *cipher;
+    size_t aad_len;
+    char *aad;
+
+    if (item->record) {
+      fwrite(item->record, 1, (size_t)item->value_len + ENVCHAIN_VAULT_RECORD_OVERHEAD, out);
+      continue;
+    }
+
+    if (envchain_random_bytes(nonce, sizeof(nonce)) < 0) return -1;
+    aad = envchain_vault_aad(item->name, item->name_len, item->key, item->key_len, &aad_len);
+    cipher = envchain_vault_alloc(item->value_len);
+    envchain_aead_seal(key, nonce, (unsigned char*)aad, aad_len, (const unsigned char*)item->value,
+                       item->value_len, cipher, tag);
+    fwrite(nonce, 1, sizeof(nonce), out);
+    fwrite(cipher, 1, item->value_len, out);
+    fwrite(tag, 1, sizeof(tag), out);
+    free(cipher);
+    free(aad);
+  }
+
+  return ferror(out) ? -1 : 0;
+}
+
+static int
+envchain_vault_lock(const char *path)
+{
+  char *lock_path = NULL;
+  int fd;
+
+  if (asprintf(&lock_path, "%s.lock", path) < 0) return -1;
+  fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "%s: unable to open %s: %s\n", envchain_name, lock_path, strerror(errno));
+  }
+  else if (flock(fd, LOCK_EX) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  free(lock_path);
+  return fd;
+}
+
+static int
+envchain_vault_ensure_dir(const char *path)
+{
+  char *copy = strdup(path);
+  const char *dir;
+  int result = 0;
+
+  if (copy == NULL) return -1;
+  dir = dirname(copy);
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: unable to create %s: %s\n", envchain_name, dir, strerror(errno));
+    result = -1;
+  }
+  free(copy);
+  return result;
+}
+
+/*
+ * Rewrites the vault with keys/values of name stored, or with the items of
+ * name (any name when NULL) selected by delete_match removed. Existing
+ * records are copied without being decrypted.
+ */
+static int
+envchain_vault_update(const char *name, const char **keys, const char **values,
+                      const size_t *value_lens, int count,
+                      envchain_key_match_callback delete_match, void *delete_data)
+{
+  envchain_vault vault;
+  envchain_vault_item *items;
+  char *path = envchain_vault_path(), *tmp_path = NULL;
+  size_t n = 0, name_len = name ? strlen(name) : 0;
+  int lock_fd = -1, fd, result = -1, found = 0;
+  FILE *out;
+  uint32_t i;
+
+  if (path == NULL) return -1;
+  if (envchain_vault_ensure_dir(path) < 0) goto ensure_path;
+  if ((lock_fd = envchain_vault_lock(path)) < 0) goto ensure_path;
+  if (envchain_vault_open(&vault, path, delete_match == NULL) < 0) goto ensure_lock;
+
+  items = envchain_vault_alloc(sizeof(envchain_vault_item) * ((size_t)vault.count + count));
+  for (i = 0; i < vault.count; i++) {
+    const envchain_vault_entry *entry = &vault.entries[i];
+    if (delete_match
+        && (name == NULL || envchain_vault_bytes_cmp(entry->name, entry->name_len, name, name_len) == 0)
+        && delete_match(entry->name, entry->key, delete_data)) {
+      found = 1;
+      continue;
+    }
+    items[n].name = entry->name;
+    items[n].name_len = entry->name_len;
+    items[n].key = entry->key;
+    items[n].key_len = entry->key_len;
+    items[n].value_len = entry->value_len;
+    items[n].record = vault.map + entry->offset;
+    items[n].seq = n;
+    n++;
+  }
+  for (int j = 0; j < count; j++) {
+    size_t value_len = value_lens[j];
+    if (UINT32_MAX - ENVCHAIN_VAULT_RECORD_OVERHEAD < value_len) goto ensure_items;
+    items[n].name = name;
+    items[n].name_len = name_len;
+    items[n].key = keys[j];
+    items[n].key_len = strlen(keys[j]);
+    items[n].value = values[j];
+    items[n].value_len = value_len;
+    items[n].seq = n;
+    n++;
+  }
+
+  if (delete_match && !found) {
+    result = 0;
+    goto ensure_items;
+  }
+
+  if (asprintf(&tmp_path, "%s.tmp", path) < 0) {
+    tmp_path = NULL;
+    goto ensure_items;
+  }
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0 || (out = fdopen(fd, "w")) == NULL) {
+    fprintf(stderr, "%s: unable to write %s: %s\n", envchain_name, tmp_path, strerror(errno));
+    if (0 <= fd) close(fd);
+    goto ensure_items;
+  }
+  result = envchain_vault_write(out, vault.key, items, n);
+  if (fflush(out) != 0 || fsync(fileno(out)) < 0) result = -1;
+  if (fclose(out) != 0) result = -1;
+
+  /* replace atomically, so readers never see a partial vault */
+  if (result == 0 && rename(tmp_path, path) < 0) result = -1;
+  if (result < 0) {
+    fprintf(stderr, "%s: unable to write vault %s: %s\n", envchain_name, path, strerror(errno));
+    unlink(tmp_path);
+  }
+
+ensure_items:
+  free(tmp_path);
+  free(items);
+  envchain_vault_close(&vault);
+ensure_lock:
+  close(lock_fd);
+ensure_path:
+  free(path);
+  return result;
+}
+
+static int
+envchain_vault_save_values(const char *name, const char **keys, const char **values,
+                           const size_t *value_lens, int count, int require_passphrase)
+{
+  if (require_passphrase == 1) {
+    fprintf(stderr, "%s: Sorry, `--require-passphrase' is unsupported with the vault backend\n",
+            envchain_name);
+    return count;
+  }
+
+  uint64_t trace_begin = envchain_trace_begin();
+  int result = envchain_vault_update(name, keys, values, value_lens, count, NULL, NULL);
+  envchain_trace_end(ENVCHAIN_TRACE_STORE, trace_begin);
+  return result < 0 ? count : 0;
+}
+
+/* all in one rewrite, so either every selected item is deleted or none is */
+static int
+envchain_vault_delete_values(const char *name, envchain_key_match_callback match, void *data)
+{
+  uint64_t trace_begin = envchain_trace_begin();
+  int result = envchain_vault_update(name, NULL, NULL, NULL, 0, match, data);
+  envchain_trace_end(ENVCHAIN_TRACE_DELETE, trace_begin);
+  return result < 0 ? -1 : 0;
+}
+
+void
+envchain_vault_use(const char *path, const char *key_path)
+{
+  envchain_vault_path_override = path;
+  envchain_vault_key_path_override = key_path;
+}
+
+/* sealing */
+
+static void
+envchain_vault_seal_key_callback(const char *name, const char *key, void *raw_context)
+{
+  envchain_vault_seal_context *context = raw_context;
+  int i;
+
+  for (i = 0; i < context->selectors_count; i++) {
+    const envchain_selector *selector = &context->selectors[i];
+    envchain_vault_seal_source *source;
+
+    if (strcmp(selector->name, name) != 0 || !envchain_selector_has_key(selector, key)) continue;
+    if (context->sources_count == context->sources_capacity) {
+      context->sources_capacity = context->sources_capacity ? context->sources_capacity * 2 : 64;
+      context->sources = realloc(context->sources, sizeof(envchain_vault_seal_source) * context->sources_capacity);
+      if (context->sources == NULL) {
+        fprintf(stderr, "%s: malloc failed\n", envchain_name);
+        exit(10);
+      }
+    }
+    source = &context->sources[context->sources_count++];
+    source->selector = i;
+    source->key = strdup(key);
+    source->sealed = 0;
+    if (source->key == NULL) {
+      fprintf(stderr, "%s: malloc failed\n", envchain_name);
+      exit(10);
+    }
+  }
+}
+
+static int
+envchain_vault_seal_source_cmp(const void *a, const void *b)
+{
+  const envchain_vault_seal_source *x = a, *y = b;
+  if (x->selector != y->selector) return x->selector < y->selector ? -1 : 1;
+  return strcmp(x->key, y->key);
+}
+
+/*
+ * Values arrive selector by selector but without their namespace, so each is
+ * matched to the first unsealed source of its key at or after the cursor.
+ */
+static void
+envchain_vault_seal_callback(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  envchain_vault_seal_context *context = raw_context;
+  envchain_vault_seal_source *source = NULL;
+  envchain_vault_item *item;
+  size_t i;
+
+  if (context->failed) return;
+  for (i = context->cursor; i < context->sources_count; i++) {
+    if (!context->sources[i].sealed && strcmp(context->sources[i].key, key) == 0) {
+      source = &context->sources[i];
+      break;
+    }
+  }
+  if (source == NULL) {
+    fprintf(stderr, "WARNING: `%s` was added while sealing; skipped.\n", key);
+    return;
+  }
+  while (0 < i && context->sources[i - 1].selector == source->selector) i--;
+  context->cursor = i;
+
+  if (UINT32_MAX - ENVCHAIN_VAULT_RECORD_OVERHEAD < value_len) {
+    fprintf(stderr, "%s: `%s:%s` is too large for a bundle\n", envchain_name,
+            context->selectors[source->selector].name, key);
+    context->failed = 1;
+    return;
+  }
+  source->sealed = 1;
+
+  if (context->count == context->capacity) {
+    size_t capacity = context->capacity ? context->capacity * 2 : 64;
+    envchain_vault_item *items = envchain_vault_alloc(sizeof(envchain_vault_item) * capacity);
+    if (context->count) memcpy(items, context->items, sizeof(envchain_vault_item) * context->count);
+    free(context->items);
+    context->items = items;
+    context->capacity = capacity;
+  }
+
+  item = &context->items[context->count];
+  item->name = context->selectors[source->selector].name;
+  item->name_len = strlen(item->name);
+  item->key = strdup(key);
+  item->key_len = strlen(key);
+  item->value = envchain_vault_alloc(value_len + 1);
+  memcpy((char*)item->value, value, value_len);
+  item->value_len = value_len;
+  item->seq = context->count;
+  if (item->key == NULL) {
+    fprintf(stderr, "%s: malloc failed\n", envchain_name);
+    exit(10);
+  }
+  context->count++;
+}
+
+int
+envchain_vault_seal(FILE *out, const char *key_path, const envchain_selector *selectors,
+                    int selectors_count)
+{
+  envchain_vault_seal_context context;
+  unsigned char key[ENVCHAIN_AEAD_KEY_SIZE];
+  int result;
+  size_t j;
+
+  if (envchain_vault_load_key(key_path, key, 1) < 0) return 1;
+
+  /* keys are listed without secrets first, so that the values of one fetch can be told apart */
+  memset(&context, 0, sizeof(context));
+  context.selectors = selectors;
+  context.selectors_count = selectors_count;
+  result = envchain_search_keys(&envchain_vault_seal_key_callback, &context);
+  if (result == 0) {
+    if (context.sources_count) {
+      qsort(context.sources, context.sources_count, sizeof(envchain_vault_seal_source),
+            &envchain_vault_seal_source_cmp);
+    }
+    result = envchain_search_values_multi(selectors, selectors_count, &envchain_vault_seal_callback, &context);
+    if (context.failed) result = 1;
+  }
+
+  if (result == 0) {
+    uint64_t trace_begin = envchain_trace_begin();
+    if (envchain_vault_write(out, key, context.items, context.count) < 0 || fflush(out) != 0) {
+      fprintf(stderr, "%s: unable to write bundle: %s\n", envchain_name, strerror(errno));
+      result = 1;
+    }
+    envchain_trace_end(ENVCHAIN_TRACE_STORE, trace_begin);
+  }
+
+  for (j = 0; j < context.count; j++) {
+    memset((char*)context.items[j].value, 0, context.items[j].value_len);
+    free((char*)context.items[j].key);
+    free((char*)context.items[j].value);
+  }
+  free(context.items);
+  for (j = 0; j < context.sources_count; j++) free(context.sources[j].key);
+  free(context.sources);
+  memset(key, 0, sizeof(key));
+  return result;
+}
+
+const envchain_backend envchain_backend_vault = {
+  "vault",
+  envchain_vault_search_namespaces,
+  envchain_vault_search_keys,
+  envchain_vault_search_values_multi,
+  envchain_vault_save_values,
+  envchain_vault_delete_values,
+  NULL, /* records are authenticated with their name; --rename copies them */
+  NULL, /* no change notifications to watch */
+};
@@ -0,0 +1,73 @@
+/*
+ * Known-answer test for the ChaCha20-Poly1305 in envchain_crypto.c, using
+ * the AEAD test vector of RFC 8439, section 2.8.2. Vaults and bundles can't
+ * be read back if this ever changes, so `make check` runs it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "envchain.h"
+
+static const char plain[] =
+  "Ladies and Gentlemen of the class of '99: If I could offer you only one "
+  "tip for the future, sunscreen would be it.";
+
+static const unsigned char aad[] = {
+  0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7
+};
+
+static const unsigned char nonce[ENVCHAIN_AEAD_NONCE_SIZE] = {
+  0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47
+};
+
+static const unsigned char expected_cipher[] = {
+  0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+  0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+  0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+  0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+  0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+  0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+  0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+  0x61, 0x16
+};
+
+static const unsigned char expected_tag[ENVCHAIN_AEAD_TAG_SIZE] = {
+  0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91
+};
+
+int
+main(void)
+{
+  unsigned char key[ENVCHAIN_AEAD_KEY_SIZE], tag[ENVCHAIN_AEAD_TAG_SIZE];
+  unsigned char cipher[sizeof(plain) - 1], opened[sizeof(plain) - 1];
+  int failures = 0;
+
+  for (int i = 0; i < ENVCHAIN_AEAD_KEY_SIZE; i++) key[i] = 0x80 + i;
+
+  envchain_aead_seal(key, nonce, aad, sizeof(aad), (const unsigned char*)plain, sizeof(cipher),
+                     cipher, tag);
+  if (sizeof(cipher) != sizeof(expected_cipher) || memcmp(cipher, expected_cipher, sizeof(cipher)) != 0) {
+    fprintf(stderr, "FAIL: ciphertext differs from RFC 8439 2.8.2\n");
+    failures++;
+  }
+  if (memcmp(tag, expected_tag, sizeof(tag)) != 0) {
+    fprintf(stderr, "FAIL: tag differs from RFC 8439 2.8.2\n");
+    failures++;
+  }
+
+  if (envchain_aead_open(key, nonce, aad, sizeof(aad), expected_cipher, sizeof(opened), expected_tag,
+                         opened) != 0 || memcmp(opened, plain, sizeof(opened)) != 0) {
+    fprintf(stderr, "FAIL: opening the RFC 8439 2.8.2 ciphertext\n");
+    failures++;
+  }
+
+  tag[0] ^= 1;
+  if (envchain_aead_open(key, nonce, aad, sizeof(aad), cipher, sizeof(opened), tag, opened) == 0) {
+    fprintf(stderr, "FAIL: a modified tag was accepted\n");
+    failures++;
+  }
+
+  if (failures == 0) printf("aead-kat: ok\n");
+  return failures != 0;
+}
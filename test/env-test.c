@@ -0,0 +1,206 @@
+/*
+ * Checks of envchain_env.c: the order and replacement of values, values with
+ * NULs left out of envp, and the PATH lookup of envchain_execvpe and
+ * envchain_spawnvpe going on past directories where the command can't run.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "envchain.h"
+
+const char *envchain_name = "env-test";
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {                   \
+    if (!(cond)) {                              \
+      fprintf(stderr, "FAIL: " __VA_ARGS__);    \
+      fputc('\n', stderr);                      \
+      failures++;                               \
+    }                                           \
+  } while (0)
+
+typedef struct {
+  char keys[8][16];
+  char values[8][16];
+  int count;
+} collected;
+
+static void
+collect(const char *key, const char *value, size_t value_len, void *raw_context)
+{
+  collected *context = raw_context;
+  if (context->count == 8) return;
+  snprintf(context->keys[context->count], 16, "%s", key);
+  snprintf(context->values[context->count], 16, "%.*s", (int)value_len, value);
+  context->count++;
+}
+
+static int
+envp_find(char **envp, const char *entry)
+{
+  for (int i = 0; envp[i]; i++) {
+    if (strcmp(envp[i], entry) == 0) return i;
+  }
+  return -1;
+}
+
+static void
+test_env(void)
+{
+  envchain_env *env = envchain_env_new();
+  collected seen;
+  const char *value;
+  char **envp;
+  size_t bytes, len;
+  char name[16];
+
+  memset(&seen, 0, sizeof(seen));
+  setenv("ENV_TEST_A", "inherited", 1);
+  setenv("ENV_TEST_KEPT", "inherited", 1);
+
+  envchain_env_set(env, "ENV_TEST_A", "1", 1);
+  envchain_env_set(env, "ENV_TEST_B", "2", 1);
+  envchain_env_set(env, "ENV_TEST_NUL", "x\0y", 3);
+  envchain_env_set(env, "ENV_TEST_A", "3", 1);
+
+  /* a later value replaces an earlier one in place */
+  envchain_env_foreach(env, &collect, &seen);
+  CHECK(seen.count == 3, "%d values, expected 3", seen.count);
+  CHECK(strcmp(seen.keys[0], "ENV_TEST_A") == 0 && strcmp(seen.values[0], "3") == 0,
+        "first value is %s=%s, expected ENV_TEST_A=3", seen.keys[0], seen.values[0]);
+  CHECK(strcmp(seen.keys[1], "ENV_TEST_B") == 0, "second value is %s, expected ENV_TEST_B", seen.keys[1]);
+
+  value = envchain_env_get_len(env, "ENV_TEST_NUL", &len);
+  CHECK(value != NULL && len == 3 && memcmp(value, "x\0y", 3) == 0, "value with a NUL not kept");
+  CHECK(envchain_env_get(env, "ENV_TEST_MISSING") == NULL, "a key never set was found");
+
+  /* enough keys to grow the table several times */
+  for (int i = 0; i < 200; i++) {
+    snprintf(name, sizeof(name), "ENV_TEST_%d", i);
+    envchain_env_set(env, name, name, strlen(name));
+  }
+  value = envchain_env_get(env, "ENV_TEST_A");
+  CHECK(value != NULL && strcmp(value, "3") == 0, "ENV_TEST_A lost when the table grew");
+
+  envp = envchain_env_build(env, &bytes);
+  CHECK(envp_find(envp, "ENV_TEST_A=inherited") < 0, "an inherited value was not replaced");
+  CHECK(0 <= envp_find(envp, "ENV_TEST_KEPT=inherited"), "an inherited value was dropped");
+  CHECK(envp_find(envp, "ENV_TEST_A=3") < envp_find(envp, "ENV_TEST_B=2")
+        && 0 <= envp_find(envp, "ENV_TEST_A=3"), "values out of insertion order in envp");
+  for (int i = 0; envp[i]; i++) {
+    CHECK(strncmp(envp[i], "ENV_TEST_NUL=", 13) != 0, "a value with a NUL was put in envp");
+  }
+  free(envp);
+  envchain_env_free(env);
+}
+
+static void
+write_file(const char *path, const char *content, mode_t mode)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  if (fd < 0 || write(fd, content, strlen(content)) < 0 || close(fd) < 0) {
+    perror(path);
+    exit(2);
+  }
+  chmod(path, mode);
+}
+
+/* Runs file with PATH=path in the way given; returns its exit status, or -errno */
+static int
+run(int spawn, const char *path, const char *file)
+{
+  char path_entry[4096];
+  char *argv[] = {(char*)file, NULL};
+  char *envp[] = {path_entry, NULL};
+  int status;
+  pid_t pid;
+
+  snprintf(path_entry, sizeof(path_entry), "PATH=%s", path);
+  if (spawn) {
+    if (envchain_spawnvpe(&pid, file, argv, envp) < 0) return -errno;
+  }
+  else {
+    pid = fork();
+    if (pid == 0) {
+      envchain_execvpe(file, argv, envp);
+      _exit(errno == EACCES ? 126 : errno == ENOENT ? 127 : 125);
+    }
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) return -1;
+  return WEXITSTATUS(status);
+}
+
+static void
+test_path(void)
+{
+  char dir[] = "/tmp/env-test.XXXXXX";
+  char denied[64], missing[64], found[64], file[256], path[256];
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    exit(2);
+  }
+  snprintf(denied, sizeof(denied), "%s/denied", dir);
+  snprintf(missing, sizeof(missing), "%s/missing", dir);
+  snprintf(found, sizeof(found), "%s/found", dir);
+  mkdir(denied, 0700);
+  mkdir(found, 0700);
+
+  /* not executable: EACCES; no file: ENOENT; neither stops the lookup */
+  snprintf(file, sizeof(file), "%s/cmd", denied);
+  write_file(file, "#!/bin/sh\nexit 1\n", 0600);
+  snprintf(file, sizeof(file), "%s/cmd", found);
+  write_file(file, "#!/bin/sh\nexit 7\n", 0700);
+  /* no #! line: run with /bin/sh like execvp(3) does */
+  snprintf(file, sizeof(file), "%s/plain", found);
+  write_file(file, "exit 8\n", 0700);
+
+  snprintf(path, sizeof(path), "%s:%s:%s", denied, missing, found);
+  for (int spawn = 0; spawn < 2; spawn++) {
+    const char *how = spawn ? "envchain_spawnvpe" : "envchain_execvpe";
+    int status;
+
+    status = run(spawn, path, "cmd");
+    CHECK(status == 7, "%s: cmd exited with %d, expected 7 from %s", how, status, found);
+    status = run(spawn, path, "plain");
+    CHECK(status == 8, "%s: plain exited with %d, expected 8", how, status);
+
+    status = run(spawn, missing, "cmd");
+    CHECK(status == (spawn ? -ENOENT : 127), "%s: %d for a missing cmd, expected ENOENT", how, status);
+    /* without any execute bit, even root gets EACCES */
+    snprintf(file, sizeof(file), "%s:%s", denied, missing);
+    status = run(spawn, file, "cmd");
+    CHECK(status == (spawn ? -EACCES : 126), "%s: %d when cmd can't be run, expected EACCES", how, status);
+  }
+
+  snprintf(file, sizeof(file), "%s/cmd", denied);
+  unlink(file);
+  snprintf(file, sizeof(file), "%s/cmd", found);
+  unlink(file);
+  snprintf(file, sizeof(file), "%s/plain", found);
+  unlink(file);
+  rmdir(denied);
+  rmdir(found);
+  rmdir(dir);
+}
+
+int
+main(void)
+{
+  test_env();
+  test_path();
+
+  if (failures == 0) printf("env-test: ok\n");
+  return failures != 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# --export --format=json must be read back by --set --import as it was
+# written: NULs, quotes, escapes and UTF-8 included. Values that aren't UTF-8
+# can't be held by JSON, and must be skipped rather than garbled.
+#
+# Runs against a throwaway vault, so no keyring or session bus is needed.
+
+set -e
+
+ENVCHAIN=${ENVCHAIN:-./envchain}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+export ENVCHAIN_BACKEND=vault
+export ENVCHAIN_VAULT="$dir/vault"
+
+fail() {
+  echo "export-roundtrip: FAIL: $*" >&2
+  exit 1
+}
+
+printf 'a\000b' | "$ENVCHAIN" --set --stdin src WITH_NUL 2>/dev/null
+printf 'quote " backslash \\ newline \n tab \t ctrl \001 é € \360\237\230\200' | "$ENVCHAIN" --set --stdin src TEXT
+printf 'plain' | "$ENVCHAIN" --set --stdin src PLAIN
+printf 'x\377y' | "$ENVCHAIN" --set --stdin src NOT_UTF8
+
+"$ENVCHAIN" --export --format=json src > "$dir/src.json" 2> "$dir/src.err"
+grep -q 'NOT_UTF8' "$dir/src.err" || fail "no warning for a value that isn't UTF-8"
+grep -q 'NOT_UTF8' "$dir/src.json" && fail "a value that isn't UTF-8 was exported"
+
+"$ENVCHAIN" --set --import dst < "$dir/src.json"
+"$ENVCHAIN" --export --format=json dst > "$dir/dst.json"
+cmp -s "$dir/src.json" "$dir/dst.json" || fail "json differs after --set --import"
+
+# compare the stored bytes too, not only their JSON form
+for key in WITH_NUL TEXT PLAIN; do
+  "$ENVCHAIN" --export --format=nul src:$key > "$dir/src.$key" 2>/dev/null || true
+  "$ENVCHAIN" --export --format=nul dst:$key > "$dir/dst.$key" 2>/dev/null || true
+  cmp -s "$dir/src.$key" "$dir/dst.$key" || fail "$key differs after --set --import"
+done
+
+echo "export-roundtrip: ok"
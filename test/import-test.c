@@ -0,0 +1,129 @@
+/*
+ * Checks of the dotenv and NDJSON parsers of envchain_import.c. Values are
+ * caught by a stand-in envchain_save_values(), so no keychain is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "envchain.h"
+
+const char *envchain_name = "import-test";
+
+#define MAX_SAVED 16
+
+static struct {
+  int calls;
+  int count;
+  char name[64];
+  char keys[MAX_SAVED][64];
+  char values[MAX_SAVED][64];
+  size_t value_lens[MAX_SAVED];
+} saved;
+
+int
+envchain_save_values(const char *name, const char **keys, const char **values,
+                     const size_t *value_lens, int count, int require_passphrase)
+{
+  (void)require_passphrase;
+  saved.calls++;
+  saved.count = count;
+  snprintf(saved.name, sizeof(saved.name), "%s", name);
+  for (int i = 0; i < count && i < MAX_SAVED; i++) {
+    snprintf(saved.keys[i], sizeof(saved.keys[i]), "%s", keys[i]);
+    saved.value_lens[i] = value_lens[i] < sizeof(saved.values[i]) ? value_lens[i] : sizeof(saved.values[i]);
+    memcpy(saved.values[i], values[i], saved.value_lens[i]);
+  }
+  return 0;
+}
+
+/* Imports input into ns; returns what envchain_import() does */
+static int
+import(const char *input)
+{
+  FILE *in = tmpfile();
+  int result;
+
+  if (in == NULL || fputs(input, in) < 0 || fseek(in, 0, SEEK_SET) != 0) {
+    perror("tmpfile");
+    exit(2);
+  }
+  memset(&saved, 0, sizeof(saved));
+  result = envchain_import("ns", in, 0);
+  fclose(in);
+  return result;
+}
+
+/* Whether the import stored key with the value_len bytes of value */
+static int
+stored(const char *key, const char *value, size_t value_len)
+{
+  for (int i = 0; i < saved.count && i < MAX_SAVED; i++) {
+    if (strcmp(saved.keys[i], key) != 0) continue;
+    return saved.value_lens[i] == value_len && memcmp(saved.values[i], value, value_len) == 0;
+  }
+  return 0;
+}
+
+#define STORED(key, value) stored(key, value, sizeof(value) - 1)
+
+static int
+check(int ok, const char *what)
+{
+  if (ok) return 0;
+  fprintf(stderr, "FAIL: %s\n", what);
+  return 1;
+}
+
+int
+main(void)
+{
+  int failures = 0, result;
+
+  result = import("# comment\n"
+                  "\n"
+                  "export PLAIN=value\n"
+                  "DOUBLE=\"line\\nnext \\\"quoted\\\" back\\\\slash\\ttab\"\n"
+                  "SINGLE='literal $HOME \\n'\n"
+                  "  SPACED  =  unquoted value # comment\n"
+                  "HASH=a#b\n"
+                  "EMPTY=\r\n"
+                  "QUOTED_COMMENT=\"x\" # after\n");
+  failures += check(result == 0 && saved.calls == 1 && saved.count == 7, "dotenv import");
+  failures += check(strcmp(saved.name, "ns") == 0, "dotenv: namespace");
+  failures += check(STORED("PLAIN", "value"), "dotenv: export prefix");
+  failures += check(STORED("DOUBLE", "line\nnext \"quoted\" back\\slash\ttab"), "dotenv: double quote escapes");
+  failures += check(STORED("SINGLE", "literal $HOME \\n"), "dotenv: single quotes are literal");
+  failures += check(STORED("SPACED", "unquoted value"), "dotenv: spaces and trailing comment");
+  failures += check(STORED("HASH", "a#b"), "dotenv: # without space before it");
+  failures += check(STORED("EMPTY", ""), "dotenv: empty value with CRLF");
+  failures += check(STORED("QUOTED_COMMENT", "x"), "dotenv: comment after a quoted value");
+
+  result = import("{\"NUL\": \"a\\u0000b\", \"TEXT\" : \"\\\"\\/\\\\ \\u00e9 \\ud83d\\ude00\"}\n"
+                  "{}\n"
+                  "{\"LAST\":\"1\"}\n");
+  failures += check(result == 0 && saved.calls == 1 && saved.count == 3, "NDJSON import");
+  failures += check(STORED("NUL", "a\0b"), "NDJSON: \\u0000 in a value");
+  failures += check(STORED("TEXT", "\"/\\ \xc3\xa9 \xf0\x9f\x98\x80"), "NDJSON: escapes and surrogate pairs");
+  failures += check(STORED("LAST", "1"), "NDJSON: value of a later line");
+
+  /* one bad line rejects every line of the import */
+  result = import("GOOD=1\nnot a line\nALSO_GOOD=2\n");
+  failures += check(result != 0 && saved.calls == 0, "dotenv: a bad line stored nothing");
+  result = import("UNTERMINATED=\"value\n");
+  failures += check(result != 0 && saved.calls == 0, "dotenv: unterminated quote");
+  result = import("AFTER='x' y\n");
+  failures += check(result != 0 && saved.calls == 0, "dotenv: text after a quoted value");
+  result = import("{\"GOOD\": \"1\"}\n{\"KEY\": \"1\",}\n");
+  failures += check(result != 0 && saved.calls == 0, "NDJSON: a bad line stored nothing");
+  result = import("{\"K\\u0000EY\": \"1\"}\n");
+  failures += check(result != 0 && saved.calls == 0, "NDJSON: \\u0000 in a key");
+  result = import("{\"KEY\": \"\\ud83d\"}\n");
+  failures += check(result != 0 && saved.calls == 0, "NDJSON: lone surrogate");
+  result = import("{\"KEY\": \"1\"} trailing\n");
+  failures += check(result != 0 && saved.calls == 0, "NDJSON: text after the object");
+
+  if (failures == 0) printf("import-test: ok\n");
+  return failures != 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Checks of envchain_selector.c: how NAMESPACE[:KEY,...] lists are split, and
+ * how globs are expanded against a fixed list of namespaces, so that no
+ * keychain is needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "envchain.h"
+
+const char *envchain_name = "selector-test";
+
+/* unsorted and with a duplicate, as a backend may list them */
+static const char *namespaces[] = {
+  "hubot", "aws-prod-us", "aws-dev", "aws-prod-eu", "aws-prod-us", NULL
+};
+
+int
+envchain_search_namespaces(envchain_namespace_search_callback callback, void *data)
+{
+  for (int i = 0; namespaces[i]; i++) callback(namespaces[i], data);
+  return 0;
+}
+
+/* "NAME" for every key, "NAME:KEY,KEY" otherwise; selectors separated by spaces */
+static void
+format_selectors(const envchain_selector *selectors, int count, char *out, size_t size)
+{
+  size_t len = 0;
+
+  out[0] = '\0';
+  for (int i = 0; i < count && len < size; i++) {
+    len += snprintf(out + len, size - len, "%s%s", i ? " " : "", selectors[i].name);
+    for (int j = 0; j < selectors[i].keys_count && len < size; j++) {
+      len += snprintf(out + len, size - len, "%c%s", j ? ',' : ':', selectors[i].keys[j]);
+    }
+  }
+}
+
+static int
+check(const char *spec, int expand, const char *expected)
+{
+  char buf[256], got[256];
+  envchain_selector *selectors;
+  int count;
+
+  snprintf(buf, sizeof(buf), "%s", spec);
+  selectors = envchain_selectors_parse(buf, &count);
+  if (expand && envchain_selectors_expand(&selectors, &count) != 0) {
+    fprintf(stderr, "FAIL: expanding `%s` failed\n", spec);
+    free(selectors);
+    return 1;
+  }
+  format_selectors(selectors, count, got, sizeof(got));
+  free(selectors);
+
+  if (strcmp(got, expected) != 0) {
+    fprintf(stderr, "FAIL: %s `%s` gave `%s`, expected `%s`\n", expand ? "expanding" : "parsing",
+            spec, got, expected);
+    return 1;
+  }
+  return 0;
+}
+
+int
+main(void)
+{
+  int failures = 0;
+
+  failures += check("aws", 0, "aws");
+  failures += check("aws:", 0, "aws");
+  failures += check("aws:KEY1,KEY2", 0, "aws:KEY1,KEY2");
+  failures += check("aws,hubot", 0, "aws hubot");
+  failures += check("aws:,hubot", 0, "aws hubot");
+  /* a bare token following NAMESPACE:KEY is another key, not a namespace */
+  failures += check("aws:KEY1,hubot", 0, "aws:KEY1,hubot");
+  failures += check("aws:KEY1,hubot:", 0, "aws:KEY1 hubot");
+  failures += check("aws:KEY1,hubot:KEY2,KEY3", 0, "aws:KEY1 hubot:KEY2,KEY3");
+  failures += check("aws:KEY1,,KEY2", 0, "aws:KEY1,KEY2");
+
+  /* without globs, nothing is enumerated or merged */
+  failures += check("aws-dev:A,aws-dev:B", 1, "aws-dev:A aws-dev:B");
+  /* matched namespaces in strcmp order, each once */
+  failures += check("aws-prod-*:KEY", 1, "aws-prod-eu:KEY aws-prod-us:KEY");
+  failures += check("hubot,aws-*", 1, "hubot aws-dev aws-prod-eu aws-prod-us");
+  failures += check("nothing-*,hubot", 1, "hubot");
+  /* a namespace named explicitly keeps its place, with the keys of the globs too */
+  failures += check("aws-prod-*:A,aws-prod-eu:B", 1, "aws-prod-us:A aws-prod-eu:B,A");
+  failures += check("aws-prod-eu,aws-prod-*:A", 1, "aws-prod-eu aws-prod-us:A");
+  /* matched by several globs: at the first one, with the keys of all of them */
+  failures += check("aws-prod-*:A,aws-*-eu:B,A", 1, "aws-prod-eu:A,B aws-prod-us:A");
+  failures += check("aws-prod-*:A,aws-*:", 1, "aws-prod-eu aws-prod-us aws-dev");
+
+  if (failures == 0) printf("selector-test: ok\n");
+  return failures != 0;
+}